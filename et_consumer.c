@@ -33,9 +33,34 @@
 #include "evetLib.c"
 
 evetHandle evh;
-
-/* prototype */
+evetPool_t pool;
+evetFanout_t fan;
+evetReorder_t reorder;
+
+/* more ET systems, from -f <ET name>,<ET name>,... */
+#define MAX_EXTRA 8
+evetHandle_t extra[MAX_EXTRA];
+int          nExtra = 0;
+evetMulti_t  multi;
+evetSink_t sink;
+int        writing = 0;
+
+/* set by the signal thread; the main thread closes everything itself */
+static int stopping = 0;
+
+/* prototypes */
 static void *signal_thread (void *arg);
+static int32_t poolEvent (int32_t worker, const uint32_t *buffer, uint32_t length, void *arg);
+static int32_t orderedEvent (int32_t worker, const uint32_t *buffer, uint32_t length, void *arg);
+static void    writeResult (uint64_t seq, const void *data, uint32_t nbytes, void *arg);
+static void    closeExtra (void);
+static void    printEvent (const char *title, const uint32_t *buffer, uint32_t length,
+			   int32_t swap, int32_t mode);
+static void    flushEvents (void);
+static int     stopRequested (void);
+static void    statsWait (const struct timespec *wait);
+static int replayFile (const char *inFile, int swapMode, const evetBankFilter_t *bankFilter,
+		       int quiet, const char *outFile, uint64_t outFileBytes);
 
 int main(int argc,char **argv)
 {
@@ -44,13 +69,30 @@ int main(int argc,char **argv)
   int             i, j, c, i_tmp, status, numRead, locality;
   int             flowMode=ET_STATION_SERIAL, position=ET_END, pposition=ET_END;
   int             errflg=0, chunk=1, qSize=0, verbose=0, remote=0, blocking=1, dump=0, readData=0;
+  int             prefetch=0, nWorkers=0, nThreads=0, swapMode=EVET_SWAP_NONE, benchSeconds=0, chunkMax=0;
   int             multicast=0, broadcast=0, broadAndMulticast=0;
   int		        con[ET_STATION_SELECT_INTS];
   int             sendBufSize=0, recvBufSize=0, noDelay=0;
   int             debugLevel = ET_DEBUG_ERROR;
   unsigned short  port=0;
   char            stationName[ET_STATNAME_LENGTH], et_name[ET_FILENAME_LENGTH], host[256], interface[16];
-  char            localAddr[16];
+  char            localAddr[16], outFile[256], inFile[256];
+  char            extraName[MAX_EXTRA][ET_FILENAME_LENGTH];
+  et_sys_id       extraId;
+  et_stat_id      extraStat;
+  int32_t         source = 0;
+  int             selectMode=ET_STATION_SELECT_ALL;
+  char            selFunc[ET_FUNCNAME_LENGTH], selLib[ET_FILENAME_LENGTH];
+  char           *word;
+  evetBankFilter_t bankFilter = {-1, -1, -1, -1, -1};
+  evetBankFilter_t shedFilter = {-1, -1, -1, -1, -1};
+  evetBackpressure_t bp;
+  cpu_set_t       readerCpus, threadCpus;
+  int             pinReader=0, pinThreads=0;
+  int             filtering=0, skim=0, prescale=1, monitor=0, shedding=0;
+  int64_t         flushTime=0;
+  char            title[ET_FILENAME_LENGTH + 64];
+  uint64_t        outFileBytes=0;
 
   int             mcastAddrCount = 0, mcastAddrMax = 10;
   char            mcastAddr[mcastAddrMax][16];
@@ -61,11 +103,16 @@ int main(int argc,char **argv)
   et_openconfig   openconfig;
   sigset_t        sigblock;
   struct timespec timeout;
+  struct timespec flushWait = {0, 100000000};
+  int             printed=0;
   struct timespec t1, t2;
 
   /* statistics variables */
   double          rate=0.0, avgRate=0.0;
   int64_t         count=0, totalCount=0, totalT=0, time, time1, time2, bytes=0, totalBytes=0;
+  evetStats_t     stats;
+  evetHist_t      latency;
+  int64_t         benchStart=0;
 
   const unsigned int MAXBUFLEN = 100*1024;
 
@@ -80,13 +127,39 @@ int main(int argc,char **argv)
       {"nd",   0, NULL, 7},
       {"dump", 0, NULL, 8},
       {"read", 0, NULL, 9},
+      {"pf",   0, NULL, 10},
+      {"nw",   1, NULL, 11},
+      {"swap", 1, NULL, 12},
+      {"bench",1, NULL, 13},
+      {"cmax", 1, NULL, 14},
+      {"o",    1, NULL, 15},
+      {"osize",1, NULL, 16},
+      {"sel",  1, NULL, 17},
+      {"type", 1, NULL, 18},
+      {"selfunc", 1, NULL, 19},
+      {"sellib",  1, NULL, 20},
+      {"tag",  1, NULL, 21},
+      {"child",1, NULL, 22},
+      {"in",   1, NULL, 23},
+      {"nt",   1, NULL, 24},
+      {"skim", 0, NULL, 25},
+      {"pre",  1, NULL, 26},
+      {"mon",  1, NULL, 27},
+      {"shed", 1, NULL, 28},
+      {"cpu",  1, NULL, 29},
+      {"tcpu", 1, NULL, 30},
       {0,0,0,0}};
 
   memset(host, 0, 256);
+  memset(selFunc, 0, ET_FUNCNAME_LENGTH);
+  memset(selLib, 0, ET_FILENAME_LENGTH);
+  for (j = 0; j < ET_STATION_SELECT_INTS; j++)
+    con[j] = -1;
   memset(interface, 0, 16);
   memset(mcastAddr, 0, (size_t) mcastAddrMax*16);
   memset(et_name, 0, ET_FILENAME_LENGTH);
   memset(stationName, 0, ET_STATNAME_LENGTH);
+  memset(inFile, 0, 256);
 
   while ((c = getopt_long_only(argc, argv, "vbmhrn:s:p:f:c:q:a:i:", long_options, 0)) != EOF) {
 
@@ -135,11 +208,22 @@ int main(int argc,char **argv)
       break;
 
     case 'f':
-      if (strlen(optarg) >= ET_FILENAME_LENGTH) {
-	fprintf(stderr, "ET file name is too long\n");
-	exit(-1);
+      /* several ET systems are read in turn */
+      nExtra = 0;
+      for (word = strtok(optarg, ","), j = 0; word != NULL; word = strtok(NULL, ","), j++) {
+	if (strlen(word) >= ET_FILENAME_LENGTH) {
+	  fprintf(stderr, "ET file name is too long\n");
+	  exit(-1);
+	}
+	if (j > MAX_EXTRA) {
+	  fprintf(stderr, "At most %d ET systems\n", MAX_EXTRA + 1);
+	  exit(-1);
+	}
+	if (j == 0)
+	  strcpy(et_name, word);
+	else
+	  strcpy(extraName[nExtra++], word);
       }
-      strcpy(et_name, optarg);
       break;
 
     case 'i':
@@ -232,6 +316,200 @@ int main(int argc,char **argv)
       readData = 1;
       break;
 
+      /* case pf */
+    case 10:
+      prefetch = 1;
+      break;
+
+      /* case nw */
+    case 11:
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0) {
+	nWorkers = i_tmp;
+      } else {
+	printf("Invalid argument to -nw. Must be > 0.\n");
+	exit(-1);
+      }
+      break;
+
+      /* case swap */
+    case 12:
+      if (strcmp(optarg, "chunk") == 0) {
+	swapMode = EVET_SWAP_CHUNK;
+      } else if (strcmp(optarg, "lazy") == 0) {
+	swapMode = EVET_SWAP_LAZY;
+      } else {
+	printf("Invalid argument to -swap. Must be chunk or lazy.\n");
+	exit(-1);
+      }
+      break;
+
+      /* case bench */
+    case 13:
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0) {
+	benchSeconds = i_tmp;
+      } else {
+	printf("Invalid argument to -bench. Must be > 0.\n");
+	exit(-1);
+      }
+      break;
+
+      /* case cmax */
+    case 14:
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0 && i_tmp < 100001) {
+	chunkMax = i_tmp;
+      } else {
+	printf("Invalid argument to -cmax. Must < 100001 & > 0.\n");
+	exit(-1);
+      }
+      break;
+
+      /* case o */
+    case 15:
+      if (strlen(optarg) >= 255) {
+	fprintf(stderr, "output file name is too long\n");
+	exit(-1);
+      }
+      strcpy(outFile, optarg);
+      writing = 1;
+      break;
+
+      /* case osize */
+    case 16:
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0) {
+	outFileBytes = (uint64_t)i_tmp << 20;
+      } else {
+	printf("Invalid argument to -osize. Must be > 0.\n");
+	exit(-1);
+      }
+      break;
+
+      /* case sel: comma separated select words, -1 for don't care */
+    case 17:
+      j = 0;
+      for (word = strtok(optarg, ","); word != NULL; word = strtok(NULL, ",")) {
+	if (j >= ET_STATION_SELECT_INTS) {
+	  printf("Invalid argument to -sel. At most %d words.\n", ET_STATION_SELECT_INTS);
+	  exit(-1);
+	}
+	con[j++] = (int) strtol(word, NULL, 0);
+      }
+      if (selectMode != ET_STATION_SELECT_USER)
+	selectMode = ET_STATION_SELECT_MATCH;
+      break;
+
+      /* case type: event type, in control word 0 */
+    case 18:
+      con[0] = (int) strtol(optarg, NULL, 0);
+      if (selectMode != ET_STATION_SELECT_USER)
+	selectMode = ET_STATION_SELECT_MATCH;
+      break;
+
+      /* case selfunc */
+    case 19:
+      if (strlen(optarg) >= ET_FUNCNAME_LENGTH) {
+	fprintf(stderr, "select function name is too long\n");
+	exit(-1);
+      }
+      strcpy(selFunc, optarg);
+      selectMode = ET_STATION_SELECT_USER;
+      break;
+
+      /* case sellib */
+    case 20:
+      if (strlen(optarg) >= ET_FILENAME_LENGTH) {
+	fprintf(stderr, "select library name is too long\n");
+	exit(-1);
+      }
+      strcpy(selLib, optarg);
+      selectMode = ET_STATION_SELECT_USER;
+      break;
+
+      /* case tag: <tag> or <min>-<max> */
+    case 21:
+      bankFilter.tagMin = (int) strtol(optarg, &word, 0);
+      bankFilter.tagMax = (*word == '-') ? (int) strtol(word + 1, NULL, 0) : bankFilter.tagMin;
+      filtering = 1;
+      break;
+
+      /* case child */
+    case 22:
+      bankFilter.childTag = (int) strtol(optarg, NULL, 0);
+      filtering = 1;
+      break;
+
+      /* case in */
+    case 23:
+      if (strlen(optarg) >= 255) {
+	fprintf(stderr, "input file name is too long\n");
+	exit(-1);
+      }
+      strcpy(inFile, optarg);
+      break;
+
+      /* case nt */
+    case 24:
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0) {
+	nThreads = i_tmp;
+      } else {
+	printf("Invalid argument to -nt. Must be > 0.\n");
+	exit(-1);
+      }
+      break;
+
+      /* case skim */
+    case 25:
+      skim = 1;
+      break;
+
+      /* case pre */
+    case 26:
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0) {
+	prescale = i_tmp;
+      } else {
+	printf("Invalid argument to -pre. Must be > 0.\n");
+	exit(-1);
+      }
+      break;
+
+      /* case mon: sample 1 in N, on a non-blocking station */
+    case 27:
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0) {
+	monitor = i_tmp;
+	blocking = 0;
+      } else {
+	printf("Invalid argument to -mon. Must be > 0.\n");
+	exit(-1);
+      }
+      break;
+
+      /* case shed */
+    case 28:
+      shedFilter.tagMin = (int) strtol(optarg, &word, 0);
+      shedFilter.tagMax = (*word == '-') ? (int) strtol(word + 1, NULL, 0) : shedFilter.tagMin;
+      shedding = 1;
+      break;
+
+      /* case cpu */
+    case 29:
+      if (evetParseCpus(optarg, &readerCpus) != 0)
+	exit(-1);
+      pinReader = 1;
+      break;
+
+      /* case tcpu */
+    case 30:
+      if (evetParseCpus(optarg, &threadCpus) != 0)
+	exit(-1);
+      pinThreads = 1;
+      break;
+
     case 'v':
       verbose = 1;
       debugLevel = ET_DEBUG_INFO;
@@ -264,18 +542,73 @@ int main(int argc,char **argv)
     }
   }
 
-  if (optind < argc || errflg || strlen(et_name) < 1) {
+  if ((selectMode == ET_STATION_SELECT_USER) &&
+      ((strlen(selFunc) < 1) || (strlen(selLib) < 1))) {
+    printf("-selfunc and -sellib must be used together\n");
+    errflg++;
+  }
+
+  /* parallel stations in a worker pool take turns (equal cue) */
+  if ((selectMode != ET_STATION_SELECT_ALL) && nWorkers > 0) {
+    printf("-sel, -type and -selfunc cannot be used with -nw\n");
+    errflg++;
+  }
+
+  if (writing && nWorkers > 0) {
+    printf("-o cannot be used with -nw\n");
+    errflg++;
+  }
+
+  if (nThreads > 0 && (nWorkers > 0 || prefetch)) {
+    printf("-nt cannot be used with -nw or -pf\n");
+    errflg++;
+  }
+
+  if (nExtra > 0 && (nWorkers > 0 || nThreads > 0)) {
+    printf("several ET systems (-f) cannot be used with -nw or -nt\n");
+    errflg++;
+  }
+
+  if (strlen(inFile) > 0 && (nWorkers > 0 || nThreads > 0 || prefetch)) {
+    printf("-in cannot be used with -nw, -nt or -pf\n");
+    errflg++;
+  }
+
+  if (skim && (!filtering || nWorkers > 0 || nThreads > 0 || writing ||
+	       strlen(inFile) > 0 || swapMode == EVET_SWAP_LAZY)) {
+    printf("-skim needs -tag or -child, and cannot be used with -nw, -nt, -o, -in or -swap lazy\n");
+    errflg++;
+  }
+
+  if (monitor && (nWorkers > 0 || nThreads > 0 || benchSeconds || writing)) {
+    printf("-mon cannot be used with -nw, -nt, -bench or -o\n");
+    errflg++;
+  }
+
+  if (chunkMax && chunkMax < chunk) {
+    printf("Invalid argument to -cmax. Must be >= -c.\n");
+    errflg++;
+  }
+
+  if (optind < argc || errflg || (strlen(et_name) < 1 && strlen(inFile) < 1)) {
     fprintf(stderr,
-	    "\nusage: %s  %s\n%s\n%s\n%s\n%s\n%s\n%s\n\n",
+	    "\nusage: %s  %s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n%s\n\n",
 	    argv[0], "-f <ET name> -s <station name>",
 	    "                     [-h] [-v] [-nb] [-r] [-m] [-b] [-nd] [-read] [-dump]",
 	    "                     [-host <ET host>] [-p <ET port>]",
-	    "                     [-c <chunk size>] [-q <Q size>]",
-	    "                     [-pos <station pos>] [-ppos <parallel station pos>]",
+	    "                     [-c <chunk size>] [-cmax <max chunk size>] [-q <Q size>] [-pf] [-swap <chunk|lazy>]",
+	    "                     [-pos <station pos>] [-ppos <parallel station pos>] [-nw <workers>] [-nt <threads>]",
 	    "                     [-i <interface address>] [-a <mcast addr>]",
-	    "                     [-rb <buf size>] [-sb <buf size>]");
-
-    fprintf(stderr, "          -f    ET system's (memory-mapped file) name\n");
+	    "                     [-rb <buf size>] [-sb <buf size>]",
+	    "                     [-bench <seconds>]",
+	    "                     [-o <output file> [-osize <MB>]]",
+	    "                     [-sel <w0,w1,...>] [-type <event type>] [-selfunc <function> -sellib <library>]",
+	    "                     [-tag <tag>[-<tag>]] [-child <tag>] [-skim]",
+	    "                     [-pre <N>] [-mon <N>]",
+	    "                 or -in <EVIO file> [-v] [-bench <seconds>] [-swap <chunk|lazy>] [-tag ...] [-child ...] [-o ...]");
+
+    fprintf(stderr, "          -f    ET system's (memory-mapped file) name, or a comma separated\n");
+    fprintf(stderr, "                list of them to read in turn, with the same station on each\n");
     fprintf(stderr, "          -host ET system's host if direct connection (default to local)\n");
     fprintf(stderr, "          -s    create station of this name\n");
     fprintf(stderr, "          -h    help\n\n");
@@ -284,13 +617,42 @@ int main(int argc,char **argv)
     fprintf(stderr, "          -read read data (1 int for each event)\n");
     fprintf(stderr, "          -dump dump events back into ET (go directly to GC) instead of put\n");
     fprintf(stderr, "          -c    number of events in one get/put array\n");
+    fprintf(stderr, "          -cmax let the get/put array size follow the event rate, between -c and this\n");
+    fprintf(stderr, "          -pf   prefetch the next get/put array in a separate thread\n");
+    fprintf(stderr, "          -swap swap foreign-endian data in place, whole ET events (chunk)\n");
+    fprintf(stderr, "                or each event as it is read (lazy)\n");
     fprintf(stderr, "          -r    act as remote (TCP) client even if ET system is local\n");
     fprintf(stderr, "          -p    port, TCP if direct, else UDP\n\n");
 
     fprintf(stderr, "          -nb   make station non-blocking\n");
     fprintf(stderr, "          -q    queue size if creating non-blocking station\n");
+    fprintf(stderr, "                (reports how full the queue is and, without -pre, -sel, -type\n");
+    fprintf(stderr, "                or -nw, events missed; with -cmax, reads the largest chunk\n");
+    fprintf(stderr, "                while the queue is filling up)\n");
+    fprintf(stderr, "          -shed while a non-blocking queue is filling up, skip events with\n");
+    fprintf(stderr, "                this bank tag (or range of tags)\n");
     fprintf(stderr, "          -pos  position of station (1,2,...)\n");
-    fprintf(stderr, "          -ppos position of within a group of parallel stations (-1=end, -2=head)\n\n");
+    fprintf(stderr, "          -ppos position of within a group of parallel stations (-1=end, -2=head)\n");
+    fprintf(stderr, "          -sel  only take events whose control words match these select words\n");
+    fprintf(stderr, "                (-1 don't care; even words must be equal, odd words share a bit)\n");
+    fprintf(stderr, "          -type only take events of this type (control word 0)\n");
+    fprintf(stderr, "          -selfunc, -sellib  select events with this function from this library\n");
+    fprintf(stderr, "                (ET_STATION_SELECT_USER, gets the -sel words too)\n");
+    fprintf(stderr, "          -tag  only read events with this bank tag (or range of tags)\n");
+    fprintf(stderr, "          -child only read events with a top-level bank of this tag\n");
+    fprintf(stderr, "          -skim also take the other events out of the ET events, in place,\n");
+    fprintf(stderr, "                so downstream stations only see the ones read\n");
+    fprintf(stderr, "          -pre  station prescale: the station takes 1 in N of its events\n");
+    fprintf(stderr, "          -mon  monitor: on a non-blocking station, print 1 in N events as a\n");
+    fprintf(stderr, "                bank tree\n");
+    fprintf(stderr, "          -nw   read with this many worker threads, each attached to its own\n");
+    fprintf(stderr, "                station (<station name>_<n>) in a group of parallel stations\n");
+    fprintf(stderr, "          -nt   read with one attachment, handing the events to this many\n");
+    fprintf(stderr, "                worker threads\n");
+    fprintf(stderr, "          -cpu  run the reading thread on these CPUs (0-3,8 or node<N>),\n");
+    fprintf(stderr, "                its buffers then come from that NUMA node\n");
+    fprintf(stderr, "          -tcpu run the prefetch and worker threads on these CPUs, one\n");
+    fprintf(stderr, "                each in turn for -nw and -nt workers\n\n");
 
     fprintf(stderr, "          -i    outgoing network interface address (dot-decimal)\n");
     fprintf(stderr, "          -a    multicast address(es) (dot-decimal), may use multiple times\n");
@@ -301,6 +663,17 @@ int main(int argc,char **argv)
     fprintf(stderr, "          -sb   TCP send    buffer size (bytes)\n");
     fprintf(stderr, "          -nd   use TCP_NODELAY option\n\n");
 
+    fprintf(stderr, "          -o    write the events to this EVIO file instead of printing them,\n");
+    fprintf(stderr, "                in local byte order (foreign data swapped as -swap chunk\n");
+    fprintf(stderr, "                unless -swap is given)\n");
+    fprintf(stderr, "          -osize start a new file (<output file>.0, .1, ...) every this many MB\n\n");
+
+    fprintf(stderr, "          -in   read the events of this EVIO file instead of an ET system,\n");
+    fprintf(stderr, "                then print the rate and exit (-bench: without printing events)\n\n");
+
+    fprintf(stderr, "          -bench run for this many seconds without printing events, then print\n");
+    fprintf(stderr, "                one summary line of rate and latency (events from et_producer)\n\n");
+
     fprintf(stderr, "          This consumer works by making a direct connection to the\n");
     fprintf(stderr, "          ET system's server port and host unless at least one multicast address\n");
     fprintf(stderr, "          is specified with -a, the -m option is used, or the -b option is used\n");
@@ -329,6 +702,16 @@ int main(int argc,char **argv)
   /* spawn signal handling thread */
   pthread_create(&tid, NULL, signal_thread, (void *)NULL);
 
+  /* before anything is allocated, so it is local to the reader */
+  if (pinReader && evetPinThread(pthread_self(), &readerCpus, -1) != 0)
+    exit(1);
+
+  /* offline: same read path, events from a file */
+  if (strlen(inFile) > 0) {
+    return replayFile(inFile, swapMode, filtering ? &bankFilter : NULL,
+		      benchSeconds || writing, writing ? outFile : NULL, outFileBytes);
+  }
+
 
   /******************/
   /* open ET system */
@@ -419,9 +802,6 @@ int main(int argc,char **argv)
 
   et_open_config_setwait(openconfig, ET_OPEN_WAIT);
 
-  et_station_config_setprescale(openconfig, 1);
-  et_station_config_setselect(openconfig, ET_STATION_SELECT_ALL);
-
   et_sys_id id = 0;
   if (et_open(&id, et_name, openconfig) != ET_OK) {
     printf("%s: et_open problems\n", __func__);
@@ -431,6 +811,41 @@ int main(int argc,char **argv)
   evh.verbose = verbose;
 
   evetOpen(id, chunk, evh);
+  /* file is written in local byte order.  Swap whole ET events, so the
+     stations after us get them consistent (and marked local) */
+  if (writing && swapMode == EVET_SWAP_NONE)
+    swapMode = EVET_SWAP_CHUNK;
+  evetSetSwapMode(evh, swapMode);
+  if (chunkMax)
+    evetSetAdaptiveChunk(evh, chunk, chunkMax);
+  if (filtering)
+    evetSetBankFilter(evh, bankFilter);
+  if (skim)
+    evetSetForward(evh, 1);
+  if (monitor > 1)
+    evetSetSample(evh, monitor);
+  if (pinThreads)
+    evetSetThreadCpus(evh, &threadCpus);
+
+  for (i = 0; i < nExtra; i++) {
+    if (et_open(&extraId, extraName[i], openconfig) != ET_OK) {
+      printf("%s: et_open of %s problems\n", __func__, extraName[i]);
+      return -1;
+    }
+    extra[i].verbose = verbose;
+    evetOpen(extraId, chunk, extra[i]);
+    evetSetSwapMode(extra[i], swapMode);
+    if (pinThreads)
+      evetSetThreadCpus(extra[i], &threadCpus);
+    if (chunkMax)
+      evetSetAdaptiveChunk(extra[i], chunk, chunkMax);
+    if (filtering)
+      evetSetBankFilter(extra[i], bankFilter);
+    if (skim)
+      evetSetForward(extra[i], 1);
+    if (monitor > 1)
+      evetSetSample(extra[i], monitor);
+  }
 
   et_open_config_destroy(openconfig);
 
@@ -455,6 +870,15 @@ int main(int argc,char **argv)
   /* define station to create */
   et_station_config_init(&sconfig);
   et_station_config_setflow(sconfig, flowMode);
+  if (nWorkers > 0) {
+    et_station_config_setselect(sconfig, ET_STATION_SELECT_EQUALCUE);
+  }
+  else if (evetStationConfigSelect(sconfig, selectMode, con, selFunc, selLib) != 0) {
+    printf("%s: error in station selection\n", argv[0]);
+    goto error;
+  }
+  if (prescale > 1)
+    et_station_config_setprescale(sconfig, prescale);
   if (!blocking) {
     et_station_config_setblock(sconfig, ET_STATION_NONBLOCKING);
     if (qSize > 0) {
@@ -462,12 +886,80 @@ int main(int argc,char **argv)
     }
   }
 
+  if (nWorkers > 0) {
+    /* one parallel station, attachment and thread per worker */
+    if (evetPoolOpen(evh.etSysId, stationName, sconfig, position, nWorkers, chunk, pool) != 0) {
+      printf("%s: error opening worker pool\n", argv[0]);
+      goto error;
+    }
+    et_station_config_destroy(sconfig);
+
+    for (i = 0; i < pool.nWorkers; i++) {
+      evetSetSwapMode(pool.worker[i].evh, swapMode);
+      if (chunkMax)
+	evetSetAdaptiveChunk(pool.worker[i].evh, chunk, chunkMax);
+      if (filtering)
+	evetSetBankFilter(pool.worker[i].evh, bankFilter);
+    }
+    if (pinThreads)
+      evetPoolSetCpus(pool, &threadCpus);
+
+    if (evetPoolStart(pool, poolEvent, (void *)&verbose) != 0) {
+      printf("%s: error starting worker pool\n", argv[0]);
+      evetPoolClose(pool);
+      goto error;
+    }
+
+    /* workers run until control-C */
+    clock_gettime(CLOCK_REALTIME, &t1);
+    time1 = 1000L*t1.tv_sec + t1.tv_nsec/1000000L; /* milliseconds */
+
+    while (1) {
+      statsWait(&timeout);
+      if (stopRequested())
+	break;
+
+      clock_gettime(CLOCK_REALTIME, &t2);
+      time2 = 1000L*t2.tv_sec + t2.tv_nsec/1000000L; /* milliseconds */
+
+      /* printed events go out in batches */
+      if (time2 - flushTime >= 100) {
+	flushEvents();
+	flushTime = time2;
+      }
+      time = time2 - time1;
+
+      evetPoolGetStats(pool, stats);
+      count = stats.events - totalCount;
+      bytes = stats.bytes - totalBytes;
+      totalCount = stats.events;
+      totalBytes = stats.bytes;
+      totalT += time;
+
+      rate = 1000.0 * ((double) count) / time;
+      avgRate = 1000.0 * ((double) totalCount) / totalT;
+      printf("%s: %d workers, %3.4g Hz,  %3.4g Hz Avg.,  %3.4g MB/s\n",
+	     argv[0], pool.nWorkers, rate, avgRate, bytes / (1000.0 * time));
+      evetPrintStats(stats);
+
+      time1 = time2;
+    }
+
+    evetPoolClose(pool);
+    flushEvents();
+    if (writing) {
+      writing = 0;
+      evetSinkClose(sink);
+    }
+    return 1;
+  }
+
   if ((status =
        et_station_create_at(evh.etSysId, &my_stat, stationName, sconfig, position, pposition)) != ET_OK) {
 
     if (status == ET_ERROR_EXISTS) {
       /* my_stat contains pointer to existing station */
-      printf("%s: station already exists\n", argv[0]);
+      printf("%s: station already exists, keeping its selection\n", argv[0]);
     }
     else if (status == ET_ERROR_TOOMANY) {
       printf("%s: too many stations created\n", argv[0]);
@@ -478,47 +970,289 @@ int main(int argc,char **argv)
       goto error;
     }
   }
+
+  /* the same station on each of the other ET systems */
+  for (i = 0; i < nExtra; i++) {
+    status = et_station_create_at(extra[i].etSysId, &extraStat, stationName, sconfig, position, pposition);
+    if ((status != ET_OK && status != ET_ERROR_EXISTS) || evetAttach(extra[i], extraStat) != 0) {
+      printf("%s: error in station creation or attach on %s\n", argv[0], extraName[i]);
+      goto error;
+    }
+  }
   et_station_config_destroy(sconfig);
 
-  if (et_station_attach(evh.etSysId, my_stat, &evh.etAttId) != ET_OK) {
+  if ((status = evetAttach(evh, my_stat)) != 0) {
     printf("%s: error in station attach\n", argv[0]);
     goto error;
   }
 
+  /* how much a non-blocking station lets go past us */
+  if (!blocking &&
+      evetSetBackpressure(evh, (chunkMax ? EVET_BP_CHUNK : 0) | (shedding ? EVET_BP_SHED : 0),
+			  shedding ? &shedFilter : NULL) != 0) {
+    printf("%s: error setting up backpressure\n", argv[0]);
+    goto error;
+  }
+
+  if (nExtra > 0) {
+    /* each ET system takes a turn of one chunk */
+    evetMultiOpen(multi, nExtra + 1);
+    evetMultiAdd(multi, evh, 0);
+    for (i = 0; i < nExtra; i++)
+      evetMultiAdd(multi, extra[i], 0);
+  }
+
+  if (prefetch) {
+    if (evetSetPrefetch(evh, 1) != 0) {
+      printf("%s: error starting prefetch\n", argv[0]);
+      goto error;
+    }
+    for (i = 0; i < nExtra; i++) {
+      if (evetSetPrefetch(extra[i], 1) != 0) {
+	printf("%s: error starting prefetch on %s\n", argv[0], extraName[i]);
+	goto error;
+      }
+    }
+  }
+
+  if (writing) {
+    if (evetSinkOpen(outFile, outFileBytes, sink) != 0) {
+      printf("%s: error opening %s\n", argv[0], outFile);
+      writing = 0;
+      goto error;
+    }
+  }
+
+  if (nThreads > 0) {
+    /* one attachment, events fanned out to the threads */
+    if (evetFanoutOpen(evh, nThreads, fan) != 0) {
+      printf("%s: error starting worker threads\n", argv[0]);
+      goto error;
+    }
+
+    /* written in the order they were read, whichever thread finishes first */
+    if (writing) {
+      if (evetReorderOpen(reorder, 65536, 64 << 20, writeResult, NULL) != 0 ||
+	  evetFanoutSetReorder(fan, &reorder) != 0) {
+	printf("%s: error starting the reorder stage\n", argv[0]);
+	evetFanoutClose(fan);
+	goto error;
+      }
+    }
+
+    if (evetFanoutStart(fan, writing ? orderedEvent : poolEvent, (void *)&verbose) != 0) {
+      printf("%s: error starting worker threads\n", argv[0]);
+      evetFanoutClose(fan);
+      goto error;
+    }
+
+    /* threads run until control-C */
+    clock_gettime(CLOCK_REALTIME, &t1);
+    time1 = 1000L*t1.tv_sec + t1.tv_nsec/1000000L; /* milliseconds */
+
+    while (1) {
+      statsWait(&timeout);
+      if (stopRequested())
+	break;
+
+      clock_gettime(CLOCK_REALTIME, &t2);
+      time2 = 1000L*t2.tv_sec + t2.tv_nsec/1000000L; /* milliseconds */
+      time = time2 - time1;
+
+      evetFanoutGetStats(fan, stats);
+      count = stats.events - totalCount;
+      bytes = stats.bytes - totalBytes;
+      totalCount = stats.events;
+      totalBytes = stats.bytes;
+      totalT += time;
+
+      rate = 1000.0 * ((double) count) / time;
+      avgRate = 1000.0 * ((double) totalCount) / totalT;
+      printf("%s: %d threads, %3.4g Hz,  %3.4g Hz Avg.,  %3.4g MB/s\n",
+	     argv[0], fan.nWorkers, rate, avgRate, bytes / (1000.0 * time));
+      for (i = 0; i < fan.nWorkers; i++)
+	printf("  thread %2d: %lu events (%lu stolen)\n",
+	       i, fan.worker[i].events, fan.worker[i].steals);
+      evetPrintStats(stats);
+      if (!blocking) {
+	evetGetBackpressure(evh, bp);
+	evetPrintBackpressure(bp);
+      }
+
+      time1 = time2;
+    }
+
+    evetFanoutClose(fan);
+    evetReorderClose(reorder);
+    flushEvents();
+    /* finish the file, so it ends with a last block */
+    if (writing) {
+      writing = 0;
+      evetSinkClose(sink);
+    }
+    evetClose(evh);
+    closeExtra();
+    return 1;
+  }
+
 
   /* read time for future statistics calculations */
 
   clock_gettime(CLOCK_REALTIME, &t1);
   time1 = 1000L*t1.tv_sec + t1.tv_nsec/1000000L; /* milliseconds */
+  benchStart = time1;
+  memset(&latency, 0, sizeof(latency));
 
 
-  while(status == 0)
+  while((status == 0) && !stopRequested())
     {
 
       const uint32_t *readBuffer;
       uint32_t len;
-      status = evetReadNoCopy(evh, &readBuffer, &len);
-      bytes += len;
-      totalBytes += len;
+      /* don't park in ET forever, so the statistics keep coming, nor
+	 for long with printed events still in the buffer */
+      if (nExtra > 0)
+	status = evetMultiRead(multi, &readBuffer, &len, &source,
+			       printed ? &flushWait : &timeout);
+      else
+	status = evetReadNoCopyTimed(evh, &readBuffer, &len, printed ? &flushWait : &timeout);
+      if(status == EVET_NODATA)
+	{
+	  flushEvents();
+	  printed = 0;
+	  status = 0;
+	  goto stats;
+	}
 
       if(status == 0)
 	{
-	  printf("evetRead(%2d): \n", ++evCount);
-	  uint32_t i;
-	  for (i=0; i< (len); i++) {
-	    printf("0x%08x ", readBuffer[i]);
-	    if( (i+1) % 8 == 0)
-	      printf("\n");
+	  count++;
+	  bytes += len * sizeof(uint32_t);
+
+	  if (writing && (evetSinkWrite(sink, readBuffer, len) != 0))
+	    {
+	      printf("%s: error writing %s\n", argv[0], outFile);
+	      status = -1;
+	      break;
+	    }
+
+	  if (benchSeconds)
+	    {
+	      /* latency from the send time stamped by et_producer */
+	      if ((len > 3) && ((readBuffer[1] >> 16) == EVET_BENCH_TAG))
+		{
+		  struct timespec now;
+		  clock_gettime(CLOCK_REALTIME, &now);
+		  int64_t sent = (int64_t)(((uint64_t)readBuffer[3] << 32) | readBuffer[2]);
+		  int64_t dt = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec - sent;
+		  evetHistRecord(latency, (dt > 0) ? (uint64_t)dt : 0);
+		}
+	      goto stats;
+	    }
+
+	  if (writing)
+	    goto stats;
+
+	  if (nExtra > 0)
+	    sprintf(title, "evetRead(%2d) from %s: ", ++evCount,
+		    (source == 0) ? et_name : extraName[source - 1]);
+	  else
+	    sprintf(title, "evetRead(%2d): ", ++evCount);
+
+	  if (monitor) {
+	    evetHandle_t &from = (source == 0) ? evh : extra[source - 1];
+	    printEvent(title, readBuffer, len,
+		       from.currentChunkStat.swap && (from.swapMode != EVET_SWAP_LAZY),
+		       EVET_FORMAT_TREE);
+	  } else {
+	    printEvent(title, readBuffer, len, 0, EVET_FORMAT_HEX);
 	  }
-	  printf("\n");
+	  printed = 1;
 
 	}				//end while
 
+      /* statistics */
+    stats:
+      clock_gettime(CLOCK_REALTIME, &t2);
+      time2 = 1000L*t2.tv_sec + t2.tv_nsec/1000000L; /* milliseconds */
+
+      /* printed events go out in batches, at least every 100 ms */
+      if (printed && (time2 - flushTime >= 100)) {
+	flushEvents();
+	flushTime = time2;
+	printed = 0;
+      }
+
+      if (benchSeconds && (time2 - benchStart >= 1000L * benchSeconds))
+	{
+	  double secs = (time2 - benchStart) / 1000.0;
+	  totalCount += count;
+	  totalBytes += bytes;
+	  printf("bench: chunk %d %s events %ld %3.4g Hz %3.4g MB/s"
+		 " latency(us) p50 %.1f p90 %.1f p99 %.1f\n",
+		 chunk, blocking ? "blocking" : "nonblocking", (long)totalCount,
+		 totalCount / secs, 1e-6 * totalBytes / secs,
+		 1e-3 * evetHistPercentile(latency, 50.0),
+		 1e-3 * evetHistPercentile(latency, 90.0),
+		 1e-3 * evetHistPercentile(latency, 99.0));
+	  if (writing)
+	    evetSinkClose(sink);
+	  evetClose(evh);
+	  closeExtra();
+	  return 0;
+	}
+
+      time = time2 - time1;
+      if (time > 5000) {
+	/* reset things if necessary */
+	if ( (totalCount >= (LLONG_MAX - count)) ||
+	     (totalT >= (LLONG_MAX - time)) )  {
+	  totalT = totalCount = count = 0;
+	  time1 = time2;
+	  continue;
+	}
+	flushEvents();
+	rate = 1000.0 * ((double) count) / time;
+	totalCount += count;
+	totalBytes += bytes;
+	totalT += time;
+	avgRate = 1000.0 * ((double) totalCount) / totalT;
+	printf("%s: %3.4g Hz,  %3.4g Hz Avg.,  %3.4g MB/s",
+	       argv[0], rate, avgRate, bytes / (1000.0 * time));
+	if (chunkMax)
+	  printf(",  chunk %d", evh.etChunkSize);
+	printf("\n");
+
+	/* where the time goes: blocked in ET vs. parsing and analysis */
+	if (nExtra > 0) {
+	  evetMultiPrintStats(multi);
+	} else {
+	  evetGetStats(evh, stats);
+	  evetPrintStats(stats);
+	}
+	if (!blocking) {
+	  evetGetBackpressure(evh, bp);
+	  evetPrintBackpressure(bp);
+	}
+
+	count = 0;
+	bytes = 0;
+	time1 = time2;
+      }
     }
 
+  flushEvents();
+  if (writing) {
+    writing = 0;
+    evetSinkClose(sink);
+  }
   evetClose(evh);
+  closeExtra();
+  if (stopRequested())
+    return 1;
 
  error:
+  flushEvents();
   printf("%s: ERROR\n", argv[0]);
 
   return 0;
@@ -532,7 +1266,7 @@ static void *signal_thread (void *arg)
 {
 
   sigset_t        signal_set;
-  int             sig_number;
+  int             sig_number, i;
 
   sigemptyset(&signal_set);
   sigaddset(&signal_set, SIGINT);
@@ -542,7 +1276,230 @@ static void *signal_thread (void *arg)
 
   printf("Got control-C, exiting\n");
 
-  evetClose(evh);
+  /* the main thread leaves its loop and closes everything; wake up
+     whatever is waiting in ET so it doesn't take long */
+  __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+  if (evh.attached)
+    et_wakeup_attachment(evh.etSysId, evh.etAttId);
+  for (i = 0; i < nExtra; i++)
+    if (extra[i].attached)
+      et_wakeup_attachment(extra[i].etSysId, extra[i].etAttId);
 
+  /* a second one doesn't wait */
+  sigwait(&signal_set, &sig_number);
   exit(1);
 }
+
+static int stopRequested (void)
+{
+  return __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+}
+
+/* sleep that long, but not past a control-C */
+static void statsWait (const struct timespec *wait)
+{
+  struct timespec step = {0, 100000000};
+  int64_t left = 1000L*wait->tv_sec + wait->tv_nsec/1000000L; /* milliseconds */
+
+  for (; (left > 0) && !stopRequested(); left -= 100)
+    nanosleep(&step, NULL);
+}
+
+
+
+/************************************************************/
+/*              called by each worker for every event       */
+static int32_t poolEvent (int32_t worker, const uint32_t *buffer, uint32_t length, void *arg)
+{
+  int verbose = *(int *)arg;
+
+  if (verbose)
+    printf("worker %2d: event length = %d  header = 0x%08x 0x%08x\n",
+	   worker, length, buffer[0], (length > 1) ? buffer[1] : 0);
+
+  return 0;
+}
+
+
+
+/************************************************************/
+/*              read every event of an EVIO file            */
+static int replayFile (const char *inFile, int swapMode, const evetBankFilter_t *bankFilter,
+		       int quiet, const char *outFile, uint64_t outFileBytes)
+{
+  const uint32_t *readBuffer;
+  uint32_t        len;
+  int32_t         status;
+  int64_t         count = 0;
+  evetStats_t     stats;
+  struct timespec t1, t2;
+
+  if (evetOpenFile(inFile, evh) != 0) {
+    printf("%s: error opening %s\n", __func__, inFile);
+    return -1;
+  }
+
+  /* file is written in local byte order */
+  if (outFile != NULL && swapMode == EVET_SWAP_NONE)
+    swapMode = EVET_SWAP_CHUNK;
+  evetSetSwapMode(evh, swapMode);
+  if (bankFilter != NULL)
+    evetSetBankFilter(evh, *bankFilter);
+
+  if (outFile != NULL) {
+    if (evetSinkOpen(outFile, outFileBytes, sink) != 0) {
+      printf("%s: error opening %s\n", __func__, outFile);
+      evetClose(evh);
+      return -1;
+    }
+    writing = 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  status = 0;
+  while (!stopRequested() && (status = evetReadNoCopy(evh, &readBuffer, &len)) == 0) {
+    count++;
+
+    if (writing && (evetSinkWrite(sink, readBuffer, len) != 0)) {
+      printf("%s: error writing %s\n", __func__, outFile);
+      status = -1;
+      break;
+    }
+
+    if (quiet)
+      continue;
+
+    char title[64];
+    sprintf(title, "evetRead(%2ld): ", (long)count);
+    printEvent(title, readBuffer, len, 0, EVET_FORMAT_HEX);
+  }
+  flushEvents();
+
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+  double secs = (t2.tv_sec - t1.tv_sec) + 1e-9 * (t2.tv_nsec - t1.tv_nsec);
+
+  evetGetStats(evh, stats);
+  printf("%s: %ld events in %.3f s, %3.4g Hz,  %3.4g MB/s\n",
+	 inFile, (long)count, secs, count / secs, 1e-6 * stats.bytes / secs);
+  evetPrintStats(stats);
+
+  if (writing) {
+    writing = 0;
+    evetSinkClose(sink);
+  }
+  evetClose(evh);
+
+  return (status == EVET_EOF) ? 0 : -1;
+}
+
+
+
+/************************************************************/
+/*      -nt with -o: each thread hands its event on, in order  */
+static int32_t orderedEvent (int32_t worker, const uint32_t *buffer, uint32_t length, void *arg)
+{
+  poolEvent(worker, buffer, length, arg);
+
+  return evetReorderPut(reorder, fan.worker[worker].seq, buffer, length * sizeof(uint32_t));
+}
+
+static void writeResult (uint64_t seq, const void *data, uint32_t nbytes, void *arg)
+{
+  if (evetSinkWrite(sink, (const uint32_t *) data, nbytes / sizeof(uint32_t)) != 0)
+    printf("error writing event %lu\n", seq);
+}
+
+
+
+/************************************************************/
+/*   events are printed into a buffer, written out in batches  */
+/*   (also by the signal thread, on the way out)                */
+#define OUTBUF_SIZE (1 << 20)
+static char   outBuf[OUTBUF_SIZE];
+static size_t outFill = 0;
+static pthread_mutex_t outLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void writeEvents (void)
+{
+  if (outFill == 0)
+    return;
+
+  fwrite(outBuf, 1, outFill, stdout);
+  fflush(stdout);
+  outFill = 0;
+}
+
+static void printEvent (const char *title, const uint32_t *buffer, uint32_t length,
+			int32_t swap, int32_t mode)
+{
+  pthread_mutex_lock(&outLock);
+
+  if (outFill > OUTBUF_SIZE / 2)
+    writeEvents();
+
+  outFill += snprintf(outBuf + outFill, OUTBUF_SIZE - outFill, "%s\n", title);
+  if (outFill >= OUTBUF_SIZE)
+    outFill = OUTBUF_SIZE - 1;
+
+  size_t room = OUTBUF_SIZE - outFill;
+  size_t n = evetFormatEvent(outBuf + outFill, room, buffer, length, swap, mode);
+  if (n < room) {
+    outFill += n;
+    pthread_mutex_unlock(&outLock);
+    return;
+  }
+
+  /* too big for what is left: write out the rest, then format it on its own */
+  writeEvents();
+  size_t size = 2 * OUTBUF_SIZE;
+  char *big = NULL;
+  while (1) {
+    char *grown = (char *) realloc(big, size);
+    if (grown == NULL) {
+      /* as much as fits, and say so */
+      if (big != NULL) {
+	evetFormatEvent(big, size / 2, buffer, length, swap, mode);
+	fputs(big, stdout);
+      }
+      printf("\n... event of %u words truncated, out of memory\n", length);
+      break;
+    }
+    big = grown;
+    n = evetFormatEvent(big, size, buffer, length, swap, mode);
+    if (n < size) {
+      fwrite(big, 1, n, stdout);
+      break;
+    }
+    size *= 2;
+  }
+  fflush(stdout);
+  free(big);
+
+  pthread_mutex_unlock(&outLock);
+}
+
+static void flushEvents (void)
+{
+  pthread_mutex_lock(&outLock);
+  writeEvents();
+  pthread_mutex_unlock(&outLock);
+}
+
+
+
+/************************************************************/
+/*              detach from the other ET systems            */
+static void closeExtra (void)
+{
+  int i;
+
+  evetMultiClose(multi);
+  for (i = 0; i < nExtra; i++) {
+    if (extra[i].etSysId != 0) {
+      evetClose(extra[i]);
+      et_close(extra[i].etSysId);
+    }
+  }
+  nExtra = 0;
+}
@@ -0,0 +1,270 @@
+/*----------------------------------------------------------------------------*
+ *
+ * Description:
+ *      Synthetic EVIO producer for benchmarking evet consumers.
+ *
+ *      Each ET event holds one EVIO (v4) block of events.  Every event is a
+ *      bank with tag EVET_BENCH_TAG whose first two words are the time it
+ *      was sent (ns, CLOCK_REALTIME), so that the consumer can measure the
+ *      latency through the ET system.
+ *
+ *----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "et.h"
+#include "evetLib.h"
+
+static uint64_t
+nowNs(clockid_t clk)
+{
+  struct timespec ts;
+  clock_gettime(clk, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc,char **argv)
+{
+  int             c, i_tmp, i, j, status, nread;
+  int             errflg=0, chunk=10, perBlock=10, verbose=0, seconds=10;
+  unsigned int    eventBytes=64;
+  double          rateHz=0.0;
+  unsigned short  port=0;
+  char            et_name[ET_FILENAME_LENGTH], host[256];
+
+  et_sys_id       id;
+  et_att_id       attach;
+  et_openconfig   openconfig;
+  et_event      **pe;
+
+  uint64_t        sent=0, blockNumber=1, start, stop, next;
+
+  static struct option long_options[] =
+    { {"host", 1, NULL, 1},
+      {0,0,0,0}};
+
+  memset(host, 0, 256);
+  memset(et_name, 0, ET_FILENAME_LENGTH);
+
+  while ((c = getopt_long_only(argc, argv, "vhf:p:s:r:c:b:t:", long_options, 0)) != EOF) {
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 'f':
+      if (strlen(optarg) >= ET_FILENAME_LENGTH) {
+	fprintf(stderr, "ET file name is too long\n");
+	exit(-1);
+      }
+      strcpy(et_name, optarg);
+      break;
+
+    case 'p':
+      i_tmp = atoi(optarg);
+      if (i_tmp > 1023 && i_tmp < 65535) {
+	port = (unsigned short)i_tmp;
+      } else {
+	printf("Invalid argument to -p. Must be < 65535 & > 1023.\n");
+	exit(-1);
+      }
+      break;
+
+    case 's':
+      i_tmp = atoi(optarg);
+      if (i_tmp >= 20) {
+	eventBytes = (unsigned int)i_tmp;
+      } else {
+	printf("Invalid argument to -s. Must be >= 20.\n");
+	exit(-1);
+      }
+      break;
+
+    case 'r':
+      rateHz = atof(optarg);
+      if (rateHz < 0.0) {
+	printf("Invalid argument to -r. Must be >= 0.\n");
+	exit(-1);
+      }
+      break;
+
+    case 'c':
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0 && i_tmp < 1001) {
+	chunk = i_tmp;
+      } else {
+	printf("Invalid argument to -c. Must < 1001 & > 0.\n");
+	exit(-1);
+      }
+      break;
+
+    case 'b':
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0) {
+	perBlock = i_tmp;
+      } else {
+	printf("Invalid argument to -b. Must be > 0.\n");
+	exit(-1);
+      }
+      break;
+
+    case 't':
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0) {
+	seconds = i_tmp;
+      } else {
+	printf("Invalid argument to -t. Must be > 0.\n");
+	exit(-1);
+      }
+      break;
+
+      /* case host: */
+    case 1:
+      if (strlen(optarg) >= 255) {
+	fprintf(stderr, "host name is too long\n");
+	exit(-1);
+      }
+      strcpy(host, optarg);
+      break;
+
+    case 'v':
+      verbose = 1;
+      break;
+
+    case 'h':
+    case '?':
+    default:
+      errflg++;
+    }
+  }
+
+  if (optind < argc || errflg || strlen(et_name) < 1) {
+    fprintf(stderr,
+	    "\nusage: %s  %s\n%s\n%s\n\n",
+	    argv[0], "-f <ET name>",
+	    "                     [-h] [-v] [-host <ET host>] [-p <ET port>]",
+	    "                     [-s <event bytes>] [-r <rate Hz>] [-c <chunk>] [-b <events/ET event>] [-t <seconds>]");
+
+    fprintf(stderr, "          -f    ET system's (memory-mapped file) name\n");
+    fprintf(stderr, "          -host ET system's host (default to local)\n");
+    fprintf(stderr, "          -p    ET server port\n");
+    fprintf(stderr, "          -s    size of each EVIO event in bytes, rounded up to words (default 64)\n");
+    fprintf(stderr, "          -r    event rate in Hz, 0 for as fast as possible (default 0)\n");
+    fprintf(stderr, "          -c    number of ET events in one new/put array (default 10)\n");
+    fprintf(stderr, "          -b    number of EVIO events in each ET event (default 10)\n");
+    fprintf(stderr, "          -t    run time in seconds (default 10)\n\n");
+    exit(2);
+  }
+
+  uint32_t eventWords = (eventBytes + 3) >> 2;
+  size_t   etBytes = (EVIO_HDR_MINLENGTH + (size_t)perBlock * eventWords) * sizeof(uint32_t);
+
+  /******************/
+  /* open ET system */
+  /******************/
+  et_open_config_init(&openconfig);
+  if (port == 0) {
+    port = ET_SERVER_PORT;
+  }
+  et_open_config_setserverport(openconfig, port);
+  et_open_config_setcast(openconfig, ET_DIRECT);
+  if (strlen(host) < 1) {
+    strcpy(host, ET_HOST_LOCAL);
+  }
+  et_open_config_sethost(openconfig, host);
+  et_open_config_setwait(openconfig, ET_OPEN_WAIT);
+
+  if (et_open(&id, et_name, openconfig) != ET_OK) {
+    printf("%s: et_open problems\n", argv[0]);
+    exit(1);
+  }
+  et_open_config_destroy(openconfig);
+
+  if (et_station_attach(id, ET_GRANDCENTRAL, &attach) != ET_OK) {
+    printf("%s: error in station attach\n", argv[0]);
+    et_close(id);
+    exit(1);
+  }
+
+  pe = (et_event **) calloc((size_t)chunk, sizeof(et_event *));
+  if (pe == NULL) {
+    printf("%s: out of memory\n", argv[0]);
+    exit(1);
+  }
+
+  start = nowNs(CLOCK_MONOTONIC);
+  stop  = start + (uint64_t)seconds * 1000000000ULL;
+  next  = start;
+
+  while (nowNs(CLOCK_MONOTONIC) < stop) {
+
+    status = et_events_new(id, attach, pe, ET_SLEEP, NULL, etBytes, chunk, &nread);
+    if (status != ET_OK) {
+      printf("%s: et_events_new returned (%d) %s\n", argv[0], status, et_perror(status));
+      break;
+    }
+
+    for (i = 0; i < nread; i++) {
+      uint32_t *block, *ev;
+
+      et_event_getdata(pe[i], (void **) &block);
+
+      memset(block, 0, EVIO_HDR_MINLENGTH * sizeof(uint32_t));
+      block[EVIO_HDR_LENGTH]       = EVIO_HDR_MINLENGTH + perBlock * eventWords;
+      block[1]                     = (uint32_t) blockNumber++;
+      block[EVIO_HDR_HEADERLENGTH] = EVIO_HDR_MINLENGTH;
+      block[EVIO_HDR_COUNT]        = perBlock;
+      block[EVIO_HDR_BITINFO]      = 4 | (1 << 9);
+      block[EVIO_HDR_MAGIC]        = EVIO_BLOCK_MAGIC;
+
+      ev = block + EVIO_HDR_MINLENGTH;
+      for (j = 0; j < perBlock; j++) {
+	uint64_t t = nowNs(CLOCK_REALTIME);
+
+	ev[0] = eventWords - 1;
+	ev[1] = (EVET_BENCH_TAG << 16) | (0x1 << 8) | (j & 0xff);
+	ev[2] = (uint32_t) (t & 0xffffffff);
+	ev[3] = (uint32_t) (t >> 32);
+	ev[4] = (uint32_t) sent++;
+	ev += eventWords;
+      }
+
+      et_event_setlength(pe[i], etBytes);
+    }
+
+    status = et_events_put(id, attach, pe, nread);
+    if (status != ET_OK) {
+      printf("%s: et_events_put returned (%d) %s\n", argv[0], status, et_perror(status));
+      break;
+    }
+    if (verbose)
+      printf("%s: put %d ET events, %lu EVIO events sent\n", argv[0], nread, sent);
+
+    /* pace to the requested rate */
+    if (rateHz > 0.0) {
+      next += (uint64_t)(1e9 * nread * perBlock / rateHz);
+      uint64_t now = nowNs(CLOCK_MONOTONIC);
+      if (next > now) {
+	struct timespec ts;
+	ts.tv_sec  = (next - now) / 1000000000ULL;
+	ts.tv_nsec = (next - now) % 1000000000ULL;
+	nanosleep(&ts, NULL);
+      }
+    }
+  }
+
+  double elapsed = 1e-9 * (nowNs(CLOCK_MONOTONIC) - start);
+  printf("%s: sent %lu events in %.1f s, %3.4g Hz, %3.4g MB/s\n",
+	 argv[0], sent, elapsed, sent / elapsed,
+	 1e-6 * sent * eventWords * sizeof(uint32_t) / elapsed);
+
+  et_station_detach(id, attach);
+  et_close(id);
+  free(pe);
+
+  return 0;
+}
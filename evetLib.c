@@ -1,25 +1,598 @@
 #include <byteswap.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "evetLib.h"
 
 #define EVETCHECKINIT(x)					\
-  if(x.etSysId == 0) {						\
+  if((x.etSysId == 0) && (x.fileData == NULL)) {		\
     printf("%s: ERROR: evet not initiallized\n", __func__);	\
     return -1;}
 
+/*
+  Thread placement and buffers.  On a multi-socket node the reader, its
+  helper threads and their buffers belong on the socket nearest the ET
+  shared memory, and should not migrate.
+*/
+
+static int32_t
+evetParseCpuRanges(const char *p, cpu_set_t *cpus)
+{
+  while((*p != '\0') && (*p != '\n'))
+    {
+      char *end;
+      long first = strtol(p, &end, 10), last = first, cpu;
+      if(end == p)
+	return -1;
+      if(*end == '-')
+	{
+	  p = end + 1;
+	  last = strtol(p, &end, 10);
+	  if(end == p)
+	    return -1;
+	}
+      if((first < 0) || (last < first) || (last >= CPU_SETSIZE))
+	return -1;
+
+      for(cpu = first; cpu <= last; cpu++)
+	CPU_SET(cpu, cpus);
+
+      p = end;
+      if(*p == ',')
+	p++;
+      else if((*p != '\0') && (*p != '\n'))
+	return -1;
+    }
+
+  return (CPU_COUNT(cpus) > 0) ? 0 : -1;
+}
+
+/*
+  CPU list as taken by taskset -c ("0-3,8,10-11"), or "node<N>" for the
+  CPUs of NUMA node N.
+*/
 int32_t
-evetOpen(et_sys_id etSysId, int32_t chunk, evetHandle_t &evh)
+evetParseCpus(const char *list, cpu_set_t *cpus)
+{
+  char nodeList[1024];
+
+  CPU_ZERO(cpus);
+
+  if(strncmp(list, "node", 4) == 0)
+    {
+      char path[128];
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+	       atoi(list + 4));
+
+      FILE *f = fopen(path, "r");
+      if((f == NULL) || (fgets(nodeList, sizeof(nodeList), f) == NULL))
+	{
+	  printf("%s: ERROR: no NUMA node %s\n", __func__, list + 4);
+	  if(f != NULL)
+	    fclose(f);
+	  return -1;
+	}
+      fclose(f);
+      list = nodeList;
+    }
+
+  if(evetParseCpuRanges(list, cpus) != 0)
+    {
+      printf("%s: ERROR: invalid CPU list %s\n", __func__, list);
+      return -1;
+    }
+
+  return 0;
+}
+
+// index < 0: all of cpus, else only its index'th CPU (round robin)
+static void
+evetPickCpus(const cpu_set_t *cpus, int32_t index, cpu_set_t *pick)
+{
+  int32_t cpu, n = 0;
+
+  if(index < 0)
+    {
+      *pick = *cpus;
+      return;
+    }
+
+  index %= CPU_COUNT(cpus);
+  CPU_ZERO(pick);
+  for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+      if(CPU_ISSET(cpu, cpus) && (n++ == index))
+	{
+	  CPU_SET(cpu, pick);
+	  return;
+	}
+    }
+}
+
+/*
+  Run thread on cpus, or (index >= 0) only on the index'th of them.  Pin
+  the reading thread before evetOpen, so what it allocates is local.
+*/
+int32_t
+evetPinThread(pthread_t thread, const cpu_set_t *cpus, int32_t index)
+{
+  cpu_set_t pick;
+
+  if(CPU_COUNT(cpus) == 0)
+    {
+      printf("%s: ERROR: empty CPU set\n", __func__);
+      return -1;
+    }
+
+  evetPickCpus(cpus, index, &pick);
+
+  int32_t status = pthread_setaffinity_np(thread, sizeof(pick), &pick);
+  if(status != 0)
+    {
+      printf("%s: ERROR: pthread_setaffinity_np returned (%d) %s\n",
+	     __func__, status, strerror(status));
+      return -1;
+    }
+
+  return 0;
+}
+
+// pthread_create, the thread starting on its CPUs (cpus NULL: anywhere)
+static int32_t
+evetCreateThread(pthread_t *thread, const cpu_set_t *cpus, int32_t index,
+		 void *(*start)(void *), void *arg)
+{
+  if(cpus == NULL)
+    return pthread_create(thread, NULL, start, arg);
+
+  pthread_attr_t attr;
+  cpu_set_t pick;
+
+  evetPickCpus(cpus, index, &pick);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setaffinity_np(&attr, sizeof(pick), &pick);
+  int32_t status = pthread_create(thread, &attr, start, arg);
+  pthread_attr_destroy(&attr);
+
+  return status;
+}
+
+static inline size_t
+evetBufferBytes(size_t size)
+{
+  return (size >= EVET_HUGEPAGE_BYTES) ?
+    (size + EVET_HUGEPAGE_BYTES - 1) & ~((size_t)EVET_HUGEPAGE_BYTES - 1) : size;
+}
+
+/*
+  Zeroed, page aligned buffer.  Big ones come from reserved hugepages if
+  there are any, else are marked for transparent hugepages.  Every page
+  is touched here, so it is taken from the NUMA node the calling thread
+  runs on.  Free with evetFreeBuffer, giving the same size.
+*/
+void *
+evetAllocBuffer(size_t size)
+{
+  size_t bytes = evetBufferBytes(size);
+  void *p = MAP_FAILED;
+
+  if(size >= EVET_HUGEPAGE_BYTES)
+    p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+
+  if(p == MAP_FAILED)
+    {
+      p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(p == MAP_FAILED)
+	return NULL;
+
+      if(size >= EVET_HUGEPAGE_BYTES)
+	madvise(p, bytes, MADV_HUGEPAGE);
+      memset(p, 0, bytes);
+    }
+
+  return p;
+}
+
+void
+evetFreeBuffer(void *p, size_t size)
+{
+  if(p != NULL)
+    munmap(p, evetBufferBytes(size));
+}
+
+/*
+  Statistics
+*/
+
+static inline uint64_t
+evetNowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// CLOCK_REALTIME deadline, timeout from now, for pthread_cond_timedwait
+static void
+evetAbsTime(const struct timespec *timeout, struct timespec *abstime)
+{
+  clock_gettime(CLOCK_REALTIME, abstime);
+  abstime->tv_sec  += timeout->tv_sec;
+  abstime->tv_nsec += timeout->tv_nsec;
+  if(abstime->tv_nsec >= 1000000000)
+    {
+      abstime->tv_sec++;
+      abstime->tv_nsec -= 1000000000;
+    }
+}
+
+/*
+  Value below which percentile (0-100) of the entries fall, to the
+  resolution of the bucket.
+*/
+uint64_t
+evetHistPercentile(const evetHist_t &hist, double percentile)
+{
+  if(hist.count == 0)
+    return 0;
+
+  uint64_t target = (uint64_t)((percentile / 100.0) * hist.count + 0.5);
+  if(target < 1)
+    target = 1;
+
+  uint64_t sum = 0;
+  uint32_t ib;
+  for(ib = 0; ib < EVET_HIST_BUCKETS; ib++)
+    {
+      sum += hist.bucket[ib];
+      if(sum >= target)
+	break;
+    }
+
+  if(ib < EVET_HIST_SUB)
+    return ib;
+
+  // highest value that lands in this bucket
+  uint32_t shift = ib / EVET_HIST_SUB - 1;
+  uint64_t value = ((uint64_t)(ib % EVET_HIST_SUB + EVET_HIST_SUB + 1) << shift) - 1;
+
+  return (value < hist.max) ? value : hist.max;
+}
+
+void
+evetHistMerge(evetHist_t &to, const evetHist_t &from)
+{
+  if(from.count == 0)
+    return;
+
+  if((to.count == 0) || (from.min < to.min))
+    to.min = from.min;
+  if(from.max > to.max)
+    to.max = from.max;
+  to.count += from.count;
+  to.sum += from.sum;
+
+  uint32_t ib;
+  for(ib = 0; ib < EVET_HIST_BUCKETS; ib++)
+    to.bucket[ib] += from.bucket[ib];
+}
+
+/*
+  Adaptive chunk size.  After each get, grow the request when a full chunk
+  came back without waiting (events are queued in the station), and shrink
+  it when chunks come back part-filled or after a long wait.  Shrinking
+  stops at what arrives in EVET_ADAPT_WINDOW_NS at the measured rate.
+  chunkSize, arrivalRate and lastGetNs are the getting thread's own.
+*/
+static void
+evetAdaptChunk(evetHandle_t &evh, int32_t &chunkSize, double &arrivalRate,
+	       uint64_t &lastGetNs, int32_t nread, uint64_t blockedNs, uint64_t now)
+{
+  if(lastGetNs != 0)
+    {
+      double dt = 1e-9 * (now - lastGetNs);
+      if(dt > 0)
+	arrivalRate += 0.125 * (nread / dt - arrivalRate);
+    }
+  lastGetNs = now;
+
+  int32_t size = chunkSize;
+
+  if((nread >= size) && (blockedNs < EVET_ADAPT_BACKLOG_NS))
+    {
+      size *= 2;
+    }
+  else if((2 * nread <= size) || (blockedNs > EVET_ADAPT_WINDOW_NS))
+    {
+      int32_t target = (int32_t)(arrivalRate * 1e-9 * EVET_ADAPT_WINDOW_NS) + 1;
+      size = (size / 2 > target) ? size / 2 : target;
+      if(size > chunkSize)
+	size = chunkSize;
+    }
+
+  if(size < evh.etChunkMin)
+    size = evh.etChunkMin;
+  if(size > evh.etChunkMax)
+    size = evh.etChunkMax;
+
+  if((evh.verbose == 1) && (size != chunkSize))
+    printf("%s: chunk %d -> %d  (read %d, blocked %.1f us, %.4g Hz)\n",
+	   __func__, chunkSize, size, nread, 1e-3 * blockedNs, arrivalRate);
+
+  chunkSize = size;
+}
+
+/*
+  Backpressure.  After each get, count the et_events that went past the
+  station from gaps in their block numbers (bp.countMissed), and every
+  EVET_BP_INTERVAL_NS look at how full its input list is.  Overloaded from EVET_BP_HIGH of the
+  cue until it drains back to EVET_BP_LOW.  bp is the getting thread's own.
+*/
+static void
+evetBackpressureGet(evetHandle_t &evh, evetBackpressure_t &bp, et_event **pe,
+		    int32_t nread, uint64_t now)
+{
+  for(int32_t i = 0; (i < nread) && bp.countMissed; i++)
+    {
+      uint32_t *data = NULL;
+      size_t len = 0;
+      int32_t swap = 0;
+
+      et_event_getdata(pe[i], (void **) &data);
+      et_event_getlength(pe[i], &len);
+      et_event_needtoswap(pe[i], &swap);
+      if((data == NULL) || (len < EVIO_HDR_MINLENGTH * sizeof(uint32_t)) ||
+	 (evetEventWord(data, EVIO_HDR_MAGIC, swap) != EVIO_BLOCK_MAGIC))
+	continue;
+
+      // a number that went back is a restarted producer, not a drop
+      uint32_t number = evetEventWord(data, EVIO_HDR_NUMBER, swap);
+      if(bp.haveBlock && (number > bp.lastBlock))
+	bp.missed += number - bp.lastBlock - 1;
+      bp.lastBlock = number;
+      bp.haveBlock = 1;
+      bp.blocks++;
+    }
+
+  if((bp.lastSampleNs != 0) && (now - bp.lastSampleNs < EVET_BP_INTERVAL_NS))
+    return;
+
+  int32_t input = 0, output = 0;
+  if((et_station_getinputcount(evh.etSysId, evh.etStatId, &input) != ET_OK) ||
+     (et_station_getoutputcount(evh.etSysId, evh.etStatId, &output) != ET_OK))
+    return;
+
+  if(bp.countMissed && (bp.lastSampleNs != 0))
+    {
+      double dt = 1e-9 * (now - bp.lastSampleNs);
+      bp.dropRate += 0.25 * ((bp.missed - bp.missedAtSample) / dt - bp.dropRate);
+    }
+  bp.missedAtSample = bp.missed;
+  bp.lastSampleNs = now;
+
+  bp.inputLevel = input;
+  bp.outputLevel = output;
+  if(input > bp.maxInputLevel)
+    bp.maxInputLevel = input;
+  bp.samples++;
+  if(input >= bp.cue)
+    bp.fullSamples++;
+
+  int32_t overloaded = bp.overloaded;
+  if(input >= EVET_BP_HIGH * bp.cue)
+    overloaded = 1;
+  else if(input <= EVET_BP_LOW * bp.cue)
+    overloaded = 0;
+
+  if(overloaded != bp.overloaded)
+    {
+      if(overloaded)
+	bp.overloads++;
+      if(evh.verbose == 1)
+	printf("%s: input list %d / %d, %s\n", __func__, input, bp.cue,
+	       overloaded ? "overloaded" : "drained");
+      bp.overloaded = overloaded;
+    }
+}
+
+/*
+  et_events_get / et_events_put, timed into the handle's stats.  The
+  prefetch thread passes its evetPrefetch_t, and keeps its stats, chunk
+  size and station samples there instead (pf NULL: the handle's).
+*/
+static int32_t
+evetEtGet(evetHandle_t &evh, evetPrefetch_t *pf, et_event **pe, int32_t mode,
+	  struct timespec *deltatime, int32_t *nread)
+{
+  evetStats_t &stats = pf ? pf->stats : evh.stats;
+  int32_t &chunkSize = pf ? pf->etChunkSize : evh.etChunkSize;
+  evetBackpressure_t &bp = pf ? pf->bp : evh.bp;
+
+  uint64_t t0 = evetNowNs();
+
+  int32_t status = et_events_get(evh.etSysId, evh.etAttId, pe,
+				 mode, deltatime, chunkSize, nread);
+
+  uint64_t t1 = evetNowNs(), dt = t1 - t0;
+
+  stats.gets++;
+  stats.getNs += dt;
+  evetHistRecord(stats.getLatency, dt);
+  if((status != ET_OK) || (*nread == 0))
+    stats.emptyGets++;
+
+  if(evh.backpressure && (status == ET_OK))
+    {
+      evetBackpressureGet(evh, bp, pe, *nread, t1);
+      if(pf == NULL)
+	evh.shedding = bp.overloaded && (bp.actions & EVET_BP_SHED);
+    }
+
+  if((evh.etChunkMax > 0) && ((status == ET_OK) || (status == ET_ERROR_TIMEOUT)))
+    {
+      evetAdaptChunk(evh, chunkSize, pf ? pf->arrivalRate : evh.arrivalRate,
+		     pf ? pf->lastGetNs : evh.lastGetNs,
+		     (status == ET_OK) ? *nread : 0, dt, t1);
+
+      // take as much of the backlog as we can with each get
+      if(bp.overloaded && (bp.actions & EVET_BP_CHUNK))
+	chunkSize = evh.etChunkMax;
+    }
+
+  return status;
+}
+
+static int32_t
+evetEtPut(evetHandle_t &evh, evetPrefetch_t *pf, et_event **pe, int32_t num)
+{
+  evetStats_t &stats = pf ? pf->stats : evh.stats;
+
+  uint64_t t0 = evetNowNs();
+
+  int32_t status = et_events_put(evh.etSysId, evh.etAttId, pe, num);
+
+  uint64_t dt = evetNowNs() - t0;
+
+  stats.puts++;
+  stats.putNs += dt;
+  evetHistRecord(stats.putLatency, dt);
+
+  return status;
+}
+
+int32_t
+evetGetStats(evetHandle_t &evh, evetStats_t &stats)
+{
+  EVETCHECKINIT(evh);
+
+  stats = evh.stats;
+
+  return 0;
+}
+
+int32_t
+evetResetStats(evetHandle_t &evh)
+{
+  EVETCHECKINIT(evh);
+
+  memset(&evh.stats, 0, sizeof(evh.stats));
+
+  return 0;
+}
+
+void
+evetPrintStats(const evetStats_t &stats)
+{
+  printf("  events %lu (%lu filtered, %lu not sampled, %lu shed)"
+	 "  bytes %lu  chunks %lu (%lu empty)\n",
+	 stats.events, stats.filtered, stats.sampledOut, stats.shed, stats.bytes, stats.chunks,
+	 stats.emptyChunks);
+  printf("  gets %lu (%lu empty) %.3f s   puts %lu %.3f s   blocked %.3f s\n",
+	 stats.gets, stats.emptyGets, 1e-9 * stats.getNs,
+	 stats.puts, 1e-9 * stats.putNs, 1e-9 * stats.waitNs);
+  printf("  get latency (us): p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+	 1e-3 * evetHistPercentile(stats.getLatency, 50),
+	 1e-3 * evetHistPercentile(stats.getLatency, 90),
+	 1e-3 * evetHistPercentile(stats.getLatency, 99),
+	 1e-3 * stats.getLatency.max);
+  printf("  put latency (us): p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+	 1e-3 * evetHistPercentile(stats.putLatency, 50),
+	 1e-3 * evetHistPercentile(stats.putLatency, 90),
+	 1e-3 * evetHistPercentile(stats.putLatency, 99),
+	 1e-3 * stats.putLatency.max);
+}
+
+template <int32_t SWAP>
+static int32_t evetNextEventT(evetHandle_t &evh, const uint32_t **outputBuffer,
+			      uint32_t *length);
+
+static int32_t evetDropAdd(evetHandle_t &evh, const uint32_t *event);
+static int32_t evetForwardCompact(evetHandle_t &evh, et_event **pe, int32_t n);
+static int32_t evetLazyFinish(evetHandle_t &evh);
+
+// Pick evetNextEventT for the byte order of the current chunk
+static inline void
+evetSetNextEvent(evetHandle_t &evh)
+{
+  evh.nextEvent = evh.currentChunkStat.swap ? evetNextEventT<1> : evetNextEventT<0>;
+}
+
+static void
+evetHandleInit(evetHandle_t &evh, int32_t chunk)
 {
-  evh.etSysId = etSysId;
   evh.etChunkSize = chunk;
+  evh.etChunkAlloc = chunk;
+  evh.etChunkMin = 0;
+  evh.etChunkMax = 0;
+  evh.arrivalRate = 0;
+  evh.lastGetNs = 0;
 
   evh.etAttId = 0;
+  evh.etStatId = 0;
+  evh.attached = 0;
   evh.currentChunkID = -1;
   evh.etChunkNumRead = -1;
+  evh.etChunkPut = 0;
 
-  evh.currentChunkStat.evioHandle = 0;
+  evh.currentChunkStat.data = NULL;
+  evh.currentChunkStat.next = NULL;
+  evh.currentChunkStat.blockEnd = NULL;
+  evh.currentChunkStat.end = NULL;
+  evh.currentChunkStat.blockEventsLeft = 0;
+  evh.currentChunkStat.lastBlock = 0;
   evh.currentChunkStat.length = 0;
   evh.currentChunkStat.endian = 0;
   evh.currentChunkStat.swap = 0;
+  evetSetNextEvent(evh);
+
+  memset(&evh.stats, 0, sizeof(evh.stats));
+
+  evh.seq = 0;
+  evh.nextSeq = 0;
+  evh.chunkSeq = 0;
+  evh.chunkIndex = -1;
+  evh.heldData = NULL;
+  evh.heldLength = 0;
+  evh.heldSeq = 0;
+  evh.heldSwap = 0;
+  evh.forward = 0;
+  evh.drops = NULL;
+  evh.nDrops = 0;
+  evh.maxDrops = 0;
+
+  evh.swapMode = EVET_SWAP_NONE;
+  evh.lazyChunk = NULL;
+  evh.prefetch = 0;
+  evh.filter = NULL;
+  evh.filterArg = NULL;
+  evh.sampleN = 0;
+  evh.sampleLeft = 0;
+  evh.pinThreads = 0;
+  CPU_ZERO(&evh.threadCpus);
+  evh.backpressure = 0;
+  evh.shedding = 0;
+  memset(&evh.bp, 0, sizeof(evh.bp));
+  evh.pf.etChunk = NULL;
+
+  evh.etChunk = NULL;
+  evh.fileData = NULL;
+  evh.fileBytes = 0;
+}
+
+int32_t
+evetOpen(et_sys_id etSysId, int32_t chunk, evetHandle_t &evh)
+{
+  evh.etSysId = etSysId;
+  evetHandleInit(evh, chunk);
 
   /* allocate some memory */
   evh.etChunk = (et_event **) calloc((size_t)chunk, sizeof(et_event *));
@@ -32,180 +605,4379 @@ evetOpen(et_sys_id etSysId, int32_t chunk, evetHandle_t &evh)
   return 0;
 }
 
+/*
+  Read the events of an EVIO (v4 or v6) file instead of an ET station.
+  The file is mapped copy-on-write, so swapping in place works as with an
+  et_event, and the whole mapping is served as one chunk.  Reads return
+  EVET_EOF after the last event.
+*/
+int32_t
+evetOpenFile(const char *path, evetHandle_t &evh)
+{
+  evh.etSysId = 0;
+  evetHandleInit(evh, 1);
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    {
+      printf("%s: ERROR: unable to open %s: %s\n",
+	     __func__, path, strerror(errno));
+      return -1;
+    }
+
+  struct stat st;
+  if((fstat(fd, &st) != 0) || (st.st_size < (off_t)(EVIO_HDR_MINLENGTH * sizeof(uint32_t))))
+    {
+      printf("%s: ERROR: %s is not an EVIO file\n", __func__, path);
+      close(fd);
+      return -1;
+    }
+
+  void *data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED)
+    {
+      printf("%s: ERROR: unable to map %s: %s\n",
+	     __func__, path, strerror(errno));
+      return -1;
+    }
+
+  // read ahead aggressively, and drop pages behind the reader first
+  madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+  madvise(data, (size_t)st.st_size, MADV_WILLNEED);
+
+  evh.fileData = (uint32_t *) data;
+  evh.fileBytes = (size_t)st.st_size;
+
+  return 0;
+}
+
+/*
+  Attach to a station.  The attachment is detached again by evetClose
+*/
+int32_t
+evetAttach(evetHandle_t &evh, et_stat_id etStatId)
+{
+  EVETCHECKINIT(evh);
+
+  if(evh.fileData != NULL)
+    {
+      printf("%s: ERROR: reading from a file\n", __func__);
+      return -1;
+    }
+
+  int32_t status = et_station_attach(evh.etSysId, etStatId, &evh.etAttId);
+  if(status != ET_OK)
+    {
+      printf("%s: ERROR: et_station_attach returned %s\n",
+	     __func__, et_perror(status));
+      return -1;
+    }
+
+  evh.etStatId = etStatId;
+  evh.attached = 1;
+
+  return 0;
+}
+
+/*
+  Event selection, done by the ET system before events reach the station.
+
+  ET_STATION_SELECT_MATCH takes an event if any select word that is not -1
+  matches its control word: equal for even words, any common bit for odd
+  ones.  ET_STATION_SELECT_USER calls function from the shared library lib
+  instead, which gets the same words.  words may be NULL (all -1).
+*/
+int32_t
+evetStationConfigSelect(et_statconfig sconfig, int32_t mode, const int32_t *words,
+			const char *function, const char *lib)
+{
+  int select[ET_STATION_SELECT_INTS];
+  int32_t i;
+
+  if((mode != ET_STATION_SELECT_ALL) && (mode != ET_STATION_SELECT_MATCH) &&
+     (mode != ET_STATION_SELECT_USER))
+    {
+      printf("%s: ERROR: invalid select mode %d\n", __func__, mode);
+      return -1;
+    }
+
+  if((mode == ET_STATION_SELECT_USER) && ((function == NULL) || (lib == NULL)))
+    {
+      printf("%s: ERROR: user select needs a function and a library\n", __func__);
+      return -1;
+    }
+
+  for(i = 0; i < ET_STATION_SELECT_INTS; i++)
+    select[i] = (words != NULL) ? words[i] : -1;
+
+  if((et_station_config_setselect(sconfig, mode) != ET_OK) ||
+     (et_station_config_setselectwords(sconfig, select) != ET_OK))
+    {
+      printf("%s: ERROR: unable to set station selection\n", __func__);
+      return -1;
+    }
+
+  if(mode == ET_STATION_SELECT_USER)
+    {
+      if((et_station_config_setfunction(sconfig, function) != ET_OK) ||
+	 (et_station_config_setlib(sconfig, lib) != ET_OK))
+	{
+	  printf("%s: ERROR: unable to set select function %s in %s\n",
+		 __func__, function, lib);
+	  return -1;
+	}
+    }
+
+  return 0;
+}
+
+/*
+  Change the select words of the station attached to with evetAttach,
+  while events are flowing.
+*/
+int32_t
+evetSetSelectWords(evetHandle_t &evh, const int32_t *words)
+{
+  int select[ET_STATION_SELECT_INTS];
+  int32_t i;
+
+  EVETCHECKINIT(evh);
+
+  if(evh.attached == 0)
+    {
+      printf("%s: ERROR: not attached with evetAttach\n", __func__);
+      return -1;
+    }
+
+  for(i = 0; i < ET_STATION_SELECT_INTS; i++)
+    select[i] = words[i];
+
+  int32_t status = et_station_setselectwords(evh.etSysId, evh.etStatId, select);
+  if(status != ET_OK)
+    {
+      printf("%s: ERROR: et_station_setselectwords returned %s\n",
+	     __func__, et_perror(status));
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+  Prefetch thread: put back the chunk handed over by the reader, then get the
+  next one.  The reader swaps chunk arrays with the thread in evetPrefetchSwap
+*/
+static void *
+evetPrefetchThread(void *arg)
+{
+  evetHandle_t *evh = (evetHandle_t *) arg;
+  evetPrefetch_t *pf = &evh->pf;
+
+  pthread_mutex_lock(&pf->lock);
+  while(1)
+    {
+      while((pf->state != EVET_PREFETCH_BUSY) && (pf->quit == 0))
+	pthread_cond_wait(&pf->cond, &pf->lock);
+
+      // quitting.  A chunk handed over while BUSY is still put back below
+      if(pf->state != EVET_PREFETCH_BUSY)
+	break;
+
+      int32_t nput = pf->putNumRead;
+      pthread_mutex_unlock(&pf->lock);
+
+      int32_t status = ET_OK, nread = 0;
+      if(nput > 0)
+	status = evetEtPut(*evh, pf, pf->etChunk, nput);
+
+      pthread_mutex_lock(&pf->lock);
+      // don't start a sleeping get if we're shutting down.  Woken up by
+      // someone else (et_wakeup_attachment), just get again
+      while(((status == ET_OK) || (status == ET_ERROR_WAKEUP)) && (pf->quit == 0))
+	{
+	  pthread_mutex_unlock(&pf->lock);
+	  status = evetEtGet(*evh, pf, pf->etChunk, ET_SLEEP, NULL, &nread);
+	  pthread_mutex_lock(&pf->lock);
+	  if(status != ET_ERROR_WAKEUP)
+	    break;
+	}
+
+      pf->putNumRead = 0;
+      pf->status = status;
+      pf->etChunkNumRead = (status == ET_OK) ? nread : 0;
+      pf->state = (status == ET_OK) ? EVET_PREFETCH_READY : EVET_PREFETCH_ERROR;
+      pthread_cond_broadcast(&pf->cond);
+    }
+  pthread_mutex_unlock(&pf->lock);
+
+  return NULL;
+}
+
+/*
+  Take over what the prefetch thread recorded since the last swap.  With
+  pf.lock held and the thread not BUSY, or after it was joined.
+*/
+static void
+evetPrefetchMerge(evetHandle_t &evh)
+{
+  evetPrefetch_t &pf = evh.pf;
+
+  evh.stats.gets      += pf.stats.gets;
+  evh.stats.emptyGets += pf.stats.emptyGets;
+  evh.stats.puts      += pf.stats.puts;
+  evh.stats.getNs     += pf.stats.getNs;
+  evh.stats.putNs     += pf.stats.putNs;
+  evetHistMerge(evh.stats.getLatency, pf.stats.getLatency);
+  evetHistMerge(evh.stats.putLatency, pf.stats.putLatency);
+  memset(&pf.stats, 0, sizeof(pf.stats));
+
+  evh.etChunkSize = pf.etChunkSize;
+  evh.arrivalRate = pf.arrivalRate;
+  evh.lastGetNs = pf.lastGetNs;
+  evh.bp = pf.bp;
+  evh.shedding = evh.bp.overloaded && (evh.bp.actions & EVET_BP_SHED);
+}
+
+static int32_t
+evetPrefetchStop(evetHandle_t &evh)
+{
+  evetPrefetch_t &pf = evh.pf;
+
+  pthread_mutex_lock(&pf.lock);
+  pf.quit = 1;
+  pthread_cond_broadcast(&pf.cond);
+  while(pf.state == EVET_PREFETCH_BUSY)
+    {
+      // break the thread out of a sleeping et_events_get
+      et_wakeup_attachment(evh.etSysId, evh.etAttId);
+
+      struct timespec wait = {0, 10000000}, abstime;
+      evetAbsTime(&wait, &abstime);
+      pthread_cond_timedwait(&pf.cond, &pf.lock, &abstime);
+    }
+  pthread_mutex_unlock(&pf.lock);
+
+  pthread_join(pf.thread, NULL);
+  evetPrefetchMerge(evh);
+
+  int32_t rval = 0;
+  // put back a chunk that was prefetched, but never read
+  if((pf.state == EVET_PREFETCH_READY) && (pf.etChunkNumRead > 0))
+    {
+      int32_t status = evetEtPut(evh, NULL, pf.etChunk, pf.etChunkNumRead);
+      if (status != ET_OK)
+	{
+	  printf("%s: ERROR: et_events_put returned %s\n",
+		 __func__, et_perror(status));
+	  rval = -1;
+	}
+    }
+
+  free(pf.etChunk);
+  pf.etChunk = NULL;
+  pthread_cond_destroy(&pf.cond);
+  pthread_mutex_destroy(&pf.lock);
+  evh.prefetch = 0;
+
+  return rval;
+}
+
+/*
+  Hand the finished chunk to the prefetch thread and take the one it
+  fetched in the meantime.  With a timeout, give up after that long and
+  return EVET_NODATA, keeping the finished chunk for the next try.
+*/
+static int32_t
+evetPrefetchSwap(evetHandle_t &evh, const struct timespec *timeout)
+{
+  evetPrefetch_t &pf = evh.pf;
+  uint64_t t0 = evetNowNs();
+  struct timespec abstime;
+
+  if(timeout != NULL)
+    evetAbsTime(timeout, &abstime);
+
+  pthread_mutex_lock(&pf.lock);
+  while(pf.state == EVET_PREFETCH_BUSY)
+    {
+      if(timeout == NULL)
+	pthread_cond_wait(&pf.cond, &pf.lock);
+      else if(pthread_cond_timedwait(&pf.cond, &pf.lock, &abstime) == ETIMEDOUT)
+	break;
+    }
+
+  evh.stats.waitNs += evetNowNs() - t0;
+
+  if(pf.state == EVET_PREFETCH_BUSY)
+    {
+      pthread_mutex_unlock(&pf.lock);
+      return EVET_NODATA;
+    }
+
+  evetPrefetchMerge(evh);
+
+  if(pf.state == EVET_PREFETCH_ERROR)
+    {
+      pthread_mutex_unlock(&pf.lock);
+      printf("%s: ERROR: prefetch returned (%d) %s\n",
+	     __func__, pf.status, et_perror(pf.status));
+      return -1;
+    }
+
+  et_event **finished = evh.etChunk;
+  evh.etChunk = pf.etChunk;
+  pf.etChunk = finished;
+
+  // et_events already put back by evetReadCopy are not put again
+  pf.putNumRead = 0;
+  if(evh.etChunkNumRead > evh.etChunkPut)
+    {
+      evetForwardCompact(evh, finished + evh.etChunkPut,
+			 evh.etChunkNumRead - evh.etChunkPut);
+      pf.putNumRead = evh.etChunkNumRead - evh.etChunkPut;
+      memmove(finished, finished + evh.etChunkPut, pf.putNumRead * sizeof(et_event *));
+    }
+  evh.etChunkNumRead = pf.etChunkNumRead;
+  evh.etChunkPut = 0;
+  evh.nDrops = 0;
+
+  pf.state = EVET_PREFETCH_BUSY;
+  pthread_cond_broadcast(&pf.cond);
+  pthread_mutex_unlock(&pf.lock);
+
+  evh.currentChunkID = -1;
+
+  return 0;
+}
+
+/*
+  Enable (1) or disable (0) fetching the next chunk in a background thread
+  while the current one is read.  Must be called after the station attach.
+*/
+int32_t
+evetSetPrefetch(evetHandle_t &evh, int32_t enable)
+{
+  EVETCHECKINIT(evh);
+
+  if(enable == evh.prefetch)
+    return 0;
+
+  if(enable == 0)
+    return evetPrefetchStop(evh);
+
+  if(evh.fileData != NULL)
+    {
+      printf("%s: ERROR: no prefetch when reading from a file\n", __func__);
+      return -1;
+    }
+
+  evetPrefetch_t &pf = evh.pf;
+
+  pf.etChunk = (et_event **) calloc((size_t)evh.etChunkAlloc, sizeof(et_event *));
+  if (pf.etChunk == NULL) {
+    printf("%s: out of memory\n", __func__);
+    return -1;
+  }
+
+  pf.etChunkNumRead = 0;
+  pf.putNumRead = 0;
+  pf.status = ET_OK;
+  pf.quit = 0;
+  pf.state = EVET_PREFETCH_BUSY; // start on the first chunk right away
+
+  memset(&pf.stats, 0, sizeof(pf.stats));
+  pf.etChunkSize = evh.etChunkSize;
+  pf.arrivalRate = evh.arrivalRate;
+  pf.lastGetNs = evh.lastGetNs;
+  pf.bp = evh.bp;
+
+  pthread_mutex_init(&pf.lock, NULL);
+  pthread_cond_init(&pf.cond, NULL);
+
+  if(evetCreateThread(&pf.thread, evh.pinThreads ? &evh.threadCpus : NULL, -1,
+		      evetPrefetchThread, (void *)&evh) != 0)
+    {
+      printf("%s: ERROR: unable to create prefetch thread\n", __func__);
+      pthread_cond_destroy(&pf.cond);
+      pthread_mutex_destroy(&pf.lock);
+      free(pf.etChunk);
+      pf.etChunk = NULL;
+      return -1;
+    }
+
+  evh.prefetch = 1;
+
+  return 0;
+}
+
+int32_t
+evetClose(evetHandle_t &evh)
+{
+  if(evh.fileData != NULL)
+    {
+      munmap(evh.fileData, evh.fileBytes);
+      evh.fileData = NULL;
+      evh.fileBytes = 0;
+      evh.etChunkNumRead = -1;
+      return 0;
+    }
+
+  // stop the prefetch thread, putting back what it holds
+  if(evh.prefetch)
+    {
+      if(evetPrefetchStop(evh) != 0)
+	return -1;
+    }
+
+  // the et_event left part read in lazy swap mode
+  if((evh.lazyChunk != NULL) && (evetLazyFinish(evh) != 0))
+    return -1;
+
+  // put any events we may still have
+  if(evh.etChunkNumRead > evh.etChunkPut)
+    {
+      evetForwardCompact(evh, evh.etChunk + evh.etChunkPut,
+			 evh.etChunkNumRead - evh.etChunkPut);
+
+      /* putting array of events */
+      int32_t status = evetEtPut(evh, NULL, evh.etChunk + evh.etChunkPut,
+				 evh.etChunkNumRead - evh.etChunkPut);
+      if (status != ET_OK)
+	{
+	  printf("%s: ERROR: et_events_put returned %s\n",
+		 __func__, et_perror(status));
+	  return -1;
+	}
+    }
+
+  if(evh.attached)
+    {
+      int32_t status = et_station_detach(evh.etSysId, evh.etAttId);
+      if (status != ET_OK)
+	{
+	  printf("%s: ERROR: et_station_detach returned %s\n",
+		 __func__, et_perror(status));
+	  return -1;
+	}
+      evh.attached = 0;
+    }
+
+  // free up the etChunk memory
+  if(evh.etChunk)
+    free(evh.etChunk);
+  evh.etChunk = NULL;
+
+  free(evh.drops);
+  evh.drops = NULL;
+  evh.nDrops = 0;
+  evh.maxDrops = 0;
+
+  return 0;
+}
+
+
+/*
+  EVIO walker
+
+  Steps through the blocks (v4) or records (v6) in the chunk data, returning
+  a pointer to each event in place.  Only the headers are read; the events
+  are left in the byte order of the chunk.  The walker is a template on the
+  byte order (SWAP), so native data goes through with no swap tests; the
+  order is picked once per chunk (evetLoadChunk).
+*/
+
+// evetWalkerNextT: the next block is in the other byte order
+#define EVET_WALK_ORDER 2
+
+template <int32_t SWAP>
+static inline uint32_t
+evetWord(const uint32_t *p)
+{
+  return SWAP ? bswap_32(*p) : *p;
+}
+
+static void
+evetWalkerInit(etChunkStat_t &cs)
+{
+  cs.end = cs.data + (cs.length >> 2);
+  cs.next = cs.data;
+  cs.blockEnd = cs.data;
+  cs.blockEventsLeft = 0;
+  cs.lastBlock = 0;
+}
+
+/*
+  Byte order of the header at blockEnd, from its magic word.
+  Returns 0 (native) or 1 (foreign), or -1 on bad data.
+*/
+static inline int32_t
+evetWalkerOrder(const etChunkStat_t &cs)
+{
+  const uint32_t *header = cs.blockEnd;
+
+  if(header[EVIO_HDR_MAGIC] == EVIO_BLOCK_MAGIC)
+    return 0;
+  if(header[EVIO_HDR_MAGIC] == bswap_32(EVIO_BLOCK_MAGIC))
+    return 1;
+
+  printf("%s: ERROR: bad magic word 0x%08x\n",
+	 __func__, header[EVIO_HDR_MAGIC]);
+  return -1;
+}
+
+/*
+  Parse the header at blockEnd, already known to be in byte order SWAP.
+  Returns 0 on success, -1 on bad data.
+*/
+template <int32_t SWAP>
+static int32_t
+evetWalkerParseBlock(etChunkStat_t &cs)
+{
+  uint32_t *header = cs.blockEnd;
+
+  uint32_t blockLength  = evetWord<SWAP>(&header[EVIO_HDR_LENGTH]);
+  uint32_t headerLength = evetWord<SWAP>(&header[EVIO_HDR_HEADERLENGTH]);
+  uint32_t count        = evetWord<SWAP>(&header[EVIO_HDR_COUNT]);
+  uint32_t bitinfo      = evetWord<SWAP>(&header[EVIO_HDR_BITINFO]);
+  uint32_t version      = bitinfo & 0xff;
+  uint32_t *events      = header + headerLength;
+
+  cs.swap = SWAP;
+
+  if(version < 4)
+    {
+      printf("%s: ERROR: EVIO version %d not supported\n",
+	     __func__, version);
+      return -1;
+    }
+
+  if(version >= 6)
+    {
+      if((size_t)(cs.end - header) < headerLength)
+	{
+	  printf("%s: ERROR: truncated record header\n", __func__);
+	  return -1;
+	}
+
+      uint32_t indexLength = evetWord<SWAP>(&header[EVIO_HDR_INDEXLENGTH]);
+      uint32_t userLength  = evetWord<SWAP>(&header[EVIO_HDR_USERLENGTH]);
+
+      events += (indexLength >> 2) + ((userLength + 3) >> 2);
+
+      // A file header is followed by the first record, not by events
+      if(blockLength == EVIO_FILE_ID)
+	{
+	  cs.blockEnd = events;
+	  cs.next = events;
+	  cs.blockEventsLeft = 0;
+	  return 0;
+	}
+
+      if((evetWord<SWAP>(&header[EVIO_HDR_COMPRESSION]) >> 28) != 0)
+	{
+	  printf("%s: ERROR: compressed EVIO records not supported\n",
+		 __func__);
+	  return -1;
+	}
+    }
+
+  if((blockLength < headerLength) || ((size_t)(cs.end - header) < blockLength) ||
+     (events > header + blockLength))
+    {
+      printf("%s: ERROR: bad block length %d (header length %d, %d words left)\n",
+	     __func__, blockLength, headerLength, (int)(cs.end - header));
+      return -1;
+    }
+
+  cs.next = events;
+  cs.blockEnd = header + blockLength;
+  cs.blockEventsLeft = count;
+  cs.lastBlock = (bitinfo >> 9) & 0x1;
+
+  return 0;
+}
+
+static inline int32_t
+evetWalkerAtEnd(const etChunkStat_t &cs)
+{
+  return cs.lastBlock || (cs.blockEnd == NULL) ||
+    ((size_t)(cs.end - cs.blockEnd) < EVIO_HDR_MINLENGTH);
+}
+
+/*
+  Parse the header at blockEnd, in whichever byte order it is.
+  Returns 0 on success, 1 if there are no more blocks, -1 on bad data.
+*/
+static int32_t
+evetWalkerNextBlock(etChunkStat_t &cs)
+{
+  if(evetWalkerAtEnd(cs))
+    return 1;
+
+  int32_t order = evetWalkerOrder(cs);
+  if(order < 0)
+    return -1;
+
+  return order ? evetWalkerParseBlock<1>(cs) : evetWalkerParseBlock<0>(cs);
+}
+
+/*
+  Get the next event from a chunk in byte order SWAP.
+  Returns 0 on success, 1 at the end of the chunk, -1 on bad data,
+  EVET_WALK_ORDER if the next block is in the other byte order (cs.swap is
+  set to it, nothing is read).
+*/
+template <int32_t SWAP>
+static inline int32_t
+evetWalkerNextT(etChunkStat_t &cs, const uint32_t **outputBuffer, uint32_t *length)
+{
+  while(cs.blockEventsLeft == 0)
+    {
+      if(evetWalkerAtEnd(cs))
+	return 1;
+
+      int32_t order = evetWalkerOrder(cs);
+      if(order < 0)
+	return -1;
+      if(order != SWAP)
+	{
+	  cs.swap = order;
+	  return EVET_WALK_ORDER;
+	}
+
+      if(evetWalkerParseBlock<SWAP>(cs) != 0)
+	return -1;
+    }
+
+  uint32_t evlen = evetWord<SWAP>(cs.next) + 1;
+  if((size_t)(cs.blockEnd - cs.next) < evlen)
+    {
+      printf("%s: ERROR: event length %d overruns block\n",
+	     __func__, evlen);
+      return -1;
+    }
+
+  *outputBuffer = cs.next;
+  *length = evlen;
+
+  cs.next += evlen;
+  cs.blockEventsLeft--;
+
+  return 0;
+}
+
+/*
+  Byte swapping
+
+  evetSwapKernel swaps nwords of 2, 4 or 8 byte items in place.  It calls
+  through a pointer that starts out as evetSwapResolve, which picks the
+  AVX2, SSSE3 or scalar version for this CPU on the first call.  Threads
+  may make that first call together; they all store the same kernel, so
+  relaxed atomic loads and stores are enough.
+*/
+
+typedef void (*evetSwapKernel_t)(uint32_t *buf, size_t nwords, int32_t width);
+
+static void
+evetSwapScalar(uint32_t *buf, size_t nwords, int32_t width)
+{
+  size_t i;
+
+  if(width == 2)
+    {
+      uint16_t *p = (uint16_t *) buf;
+      for(i = 0; i < (nwords << 1); i++)
+	p[i] = bswap_16(p[i]);
+    }
+  else if(width == 8)
+    {
+      uint64_t *p = (uint64_t *) buf;
+      for(i = 0; i < (nwords >> 1); i++)
+	p[i] = bswap_64(p[i]);
+    }
+  else
+    {
+      for(i = 0; i < nwords; i++)
+	buf[i] = bswap_32(buf[i]);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// pshufb byte order for each item width, per 16 byte lane
+static const uint8_t evetSwapMask[3][16] =
+  {
+    { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 },
+    { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 },
+    { 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 }
+  };
+
+static inline const uint8_t *
+evetSwapMaskFor(int32_t width)
+{
+  return evetSwapMask[(width == 2) ? 0 : ((width == 8) ? 2 : 1)];
+}
+
+__attribute__((target("ssse3")))
+static void
+evetSwapSSSE3(uint32_t *buf, size_t nwords, int32_t width)
+{
+  const __m128i mask = _mm_loadu_si128((const __m128i *) evetSwapMaskFor(width));
+  size_t i = 0;
+
+  for(; (i + 4) <= nwords; i += 4)
+    {
+      __m128i v = _mm_loadu_si128((__m128i *) &buf[i]);
+      _mm_storeu_si128((__m128i *) &buf[i], _mm_shuffle_epi8(v, mask));
+    }
+
+  evetSwapScalar(&buf[i], nwords - i, width);
+}
+
+__attribute__((target("avx2")))
+static void
+evetSwapAVX2(uint32_t *buf, size_t nwords, int32_t width)
+{
+  const __m256i mask =
+    _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) evetSwapMaskFor(width)));
+  size_t i = 0;
+
+  for(; (i + 16) <= nwords; i += 16)
+    {
+      __m256i v0 = _mm256_loadu_si256((__m256i *) &buf[i]);
+      __m256i v1 = _mm256_loadu_si256((__m256i *) &buf[i + 8]);
+      _mm256_storeu_si256((__m256i *) &buf[i], _mm256_shuffle_epi8(v0, mask));
+      _mm256_storeu_si256((__m256i *) &buf[i + 8], _mm256_shuffle_epi8(v1, mask));
+    }
+
+  for(; (i + 8) <= nwords; i += 8)
+    {
+      __m256i v = _mm256_loadu_si256((__m256i *) &buf[i]);
+      _mm256_storeu_si256((__m256i *) &buf[i], _mm256_shuffle_epi8(v, mask));
+    }
+
+  evetSwapScalar(&buf[i], nwords - i, width);
+}
+#endif
+
+static void evetSwapResolve(uint32_t *buf, size_t nwords, int32_t width);
+static evetSwapKernel_t evetSwapDispatch = evetSwapResolve;
+
+static inline void
+evetSwapKernel(uint32_t *buf, size_t nwords, int32_t width)
+{
+  __atomic_load_n(&evetSwapDispatch, __ATOMIC_RELAXED)(buf, nwords, width);
+}
+
+static void
+evetSwapResolve(uint32_t *buf, size_t nwords, int32_t width)
+{
+  evetSwapKernel_t kernel = evetSwapScalar;
+
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    kernel = evetSwapAVX2;
+  else if(__builtin_cpu_supports("ssse3"))
+    kernel = evetSwapSSSE3;
+#endif
+
+  __atomic_store_n(&evetSwapDispatch, kernel, __ATOMIC_RELAXED);
+  kernel(buf, nwords, width);
+}
+
+/*
+  Swap the contents of an EVIO structure of the given data type.  Container
+  headers are swapped first so that their lengths and types can be read.
+  Composite data (0xf) is swapped as 32 bit words.
+  Returns -1 if a child structure overruns nwords.
+*/
+static int32_t
+evetSwapData(uint32_t *data, uint32_t nwords, uint32_t type)
+{
+  uint32_t len;
+
+  switch(type)
+    {
+    case 0xe:
+    case 0x10: // banks
+      while(nwords >= 2)
+	{
+	  data[0] = bswap_32(data[0]);
+	  data[1] = bswap_32(data[1]);
+	  len = data[0] + 1;
+	  if((len < 2) || (len > nwords))
+	    return -1;
+	  if(evetSwapData(&data[2], len - 2, (data[1] >> 8) & 0x3f) != 0)
+	    return -1;
+	  data += len;
+	  nwords -= len;
+	}
+      break;
+
+    case 0xd:
+    case 0x20: // segments
+      while(nwords >= 1)
+	{
+	  data[0] = bswap_32(data[0]);
+	  len = (data[0] & 0xffff) + 1;
+	  if(len > nwords)
+	    return -1;
+	  if(evetSwapData(&data[1], len - 1, (data[0] >> 16) & 0x3f) != 0)
+	    return -1;
+	  data += len;
+	  nwords -= len;
+	}
+      break;
+
+    case 0xc: // tagsegments
+      while(nwords >= 1)
+	{
+	  data[0] = bswap_32(data[0]);
+	  len = (data[0] & 0xffff) + 1;
+	  if(len > nwords)
+	    return -1;
+	  if(evetSwapData(&data[1], len - 1, (data[0] >> 16) & 0xf) != 0)
+	    return -1;
+	  data += len;
+	  nwords -= len;
+	}
+      break;
+
+    case 0x3:
+    case 0x6:
+    case 0x7: // 8 bit
+      break;
+
+    case 0x4:
+    case 0x5: // 16 bit
+      evetSwapKernel(data, nwords, 2);
+      break;
+
+    case 0x8:
+    case 0x9:
+    case 0xa: // 64 bit
+      evetSwapKernel(data, nwords & ~1, 8);
+      break;
+
+    default: // 32 bit
+      evetSwapKernel(data, nwords, 4);
+      break;
+    }
+
+  return 0;
+}
+
+/*
+  Swap a whole event (a bank of length words) in place
+*/
+int32_t
+evetSwapEvent(uint32_t *event, uint32_t length)
+{
+  if(evetSwapData(event, length, 0x10) != 0)
+    {
+      printf("%s: ERROR: bad EVIO structure in event of length %d\n",
+	     __func__, length);
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+  Swap every foreign-endian block of the chunk in place: headers, v6 index
+  and user header, and (events 1) the events.
+  Returns 1 if anything was swapped, 0 if not, -1 on bad data.
+*/
+static int32_t
+evetSwapChunk(etChunkStat_t &cs, int32_t events)
+{
+  etChunkStat_t w = cs;
+  int32_t swapped = 0;
+
+  evetWalkerInit(w);
+  while(1)
+    {
+      uint32_t *header = w.blockEnd;
+
+      int32_t status = evetWalkerNextBlock(w);
+      if(status == 1)
+	break;
+      if(status != 0)
+	return -1;
+
+      if(w.swap == 0)
+	{
+	  w.blockEventsLeft = 0;
+	  continue;
+	}
+
+      uint32_t headerLength = bswap_32(header[EVIO_HDR_HEADERLENGTH]);
+
+      // block header, index and user header
+      evetSwapKernel(header, w.next - header, 4);
+
+      // v6 64 bit header words: user register and trailer position in a
+      // file header, user registers 1 and 2 in a record header
+      if(((header[EVIO_HDR_BITINFO] & 0xff) >= 6) && (headerLength >= 14))
+	{
+	  uint32_t i64 = (header[EVIO_HDR_LENGTH] == EVIO_FILE_ID) ? 8 : 10;
+	  uint32_t tmp;
+	  tmp = header[i64]; header[i64] = header[i64 + 1]; header[i64 + 1] = tmp;
+	  tmp = header[i64 + 2]; header[i64 + 2] = header[i64 + 3]; header[i64 + 3] = tmp;
+	}
+
+      while(events && (w.blockEventsLeft > 0))
+	{
+	  uint32_t len = bswap_32(w.next[0]) + 1;
+	  if((size_t)(w.blockEnd - w.next) < len)
+	    return -1;
+	  if(evetSwapEvent(w.next, len) != 0)
+	    return -1;
+	  w.next += len;
+	  w.blockEventsLeft--;
+	}
+
+      swapped = 1;
+    }
+
+  cs.swap = 0;
+
+  return swapped;
+}
+
+/*
+  Select how foreign-endian data is swapped, EVET_SWAP_*.
+  Swapping is done in place, in the et_event.
+*/
+int32_t
+evetSetSwapMode(evetHandle_t &evh, int32_t mode)
+{
+  EVETCHECKINIT(evh);
+
+  if((mode != EVET_SWAP_NONE) && (mode != EVET_SWAP_CHUNK) && (mode != EVET_SWAP_LAZY))
+    {
+      printf("%s: ERROR: invalid swap mode %d\n", __func__, mode);
+      return -1;
+    }
+
+  if(evh.forward && (mode == EVET_SWAP_LAZY))
+    {
+      printf("%s: ERROR: not with forwarding (evetSetForward)\n", __func__);
+      return -1;
+    }
+
+  if(evh.lazyChunk != NULL)
+    {
+      printf("%s: ERROR: an et_event is still being swapped lazily\n", __func__);
+      return -1;
+    }
+
+  evh.swapMode = mode;
+
+  return 0;
+}
+
+/*
+  Let the number of et_events requested per get float between min and max,
+  following the arrival rate (see evetAdaptChunk).  max 0 goes back to a
+  fixed chunk size.  Must be called before evetSetPrefetch.
+*/
+int32_t
+evetSetAdaptiveChunk(evetHandle_t &evh, int32_t min, int32_t max)
+{
+  EVETCHECKINIT(evh);
+
+  if(evh.prefetch)
+    {
+      printf("%s: ERROR: must be set before prefetch is enabled\n", __func__);
+      return -1;
+    }
+
+  if(max == 0)
+    {
+      evh.etChunkMin = evh.etChunkMax = 0;
+      return 0;
+    }
+
+  if((min < 1) || (max < min))
+    {
+      printf("%s: ERROR: invalid bounds %d - %d\n", __func__, min, max);
+      return -1;
+    }
+
+  if(max > evh.etChunkAlloc)
+    {
+      et_event **chunk = (et_event **) realloc(evh.etChunk, (size_t)max * sizeof(et_event *));
+      if(chunk == NULL)
+	{
+	  printf("%s: out of memory\n", __func__);
+	  return -1;
+	}
+      evh.etChunk = chunk;
+      evh.etChunkAlloc = max;
+    }
+
+  evh.etChunkMin = min;
+  evh.etChunkMax = max;
+  if(evh.etChunkSize < min)
+    evh.etChunkSize = min;
+  if(evh.etChunkSize > max)
+    evh.etChunkSize = max;
+  evh.arrivalRate = 0;
+  evh.lastGetNs = 0;
+
+  return 0;
+}
+
+/*
+  Start this handle's prefetch thread on cpus (NULL: anywhere).  A fan-out
+  reader goes on the first of them and its workers on the next ones, in
+  turn.  Must be set before prefetch or the fan-out is started.
+*/
+int32_t
+evetSetThreadCpus(evetHandle_t &evh, const cpu_set_t *cpus)
+{
+  EVETCHECKINIT(evh);
+
+  if(evh.prefetch)
+    {
+      printf("%s: ERROR: must be set before prefetch is enabled\n", __func__);
+      return -1;
+    }
+
+  if(cpus == NULL)
+    {
+      evh.pinThreads = 0;
+      return 0;
+    }
+
+  if(CPU_COUNT(cpus) == 0)
+    {
+      printf("%s: ERROR: empty CPU set\n", __func__);
+      return -1;
+    }
+
+  evh.threadCpus = *cpus;
+  evh.pinThreads = 1;
+
+  return 0;
+}
+
+/*
+  Filter events with any function (NULL: no filter).  For fixed predicates
+  evetSetFilter<> in evetLib.h compiles to a faster one.
+*/
+int32_t
+evetSetFilterFunction(evetHandle_t &evh, evetFilter_t filter, const void *arg)
+{
+  EVETCHECKINIT(evh);
+
+  evh.filter = filter;
+  evh.filterArg = arg;
+
+  return 0;
+}
+
+static int32_t
+evetBankFilterMatch(const uint32_t *event, uint32_t length, int32_t swap, const void *arg)
+{
+  const evetBankFilter_t *bf = (const evetBankFilter_t *) arg;
+  uint32_t header = evetEventWord(event, 1, swap);
+  int32_t tag = header >> 16;
+
+  if((bf->tagMin != -1) && (tag < bf->tagMin))
+    return 0;
+  if((bf->tagMax != -1) && (tag > bf->tagMax))
+    return 0;
+  if((bf->num != -1) && ((int32_t)(header & 0xff) != bf->num))
+    return 0;
+  if((bf->type != -1) && ((int32_t)((header >> 8) & 0x3f) != bf->type))
+    return 0;
+  if((bf->childTag != -1) && !evetHasChildTag(event, length, swap, bf->childTag))
+    return 0;
+
+  return 1;
+}
+
+/*
+  Filter events on bank tag, num, type and top-level child banks, given
+  at run time.
+*/
+int32_t
+evetSetBankFilter(evetHandle_t &evh, const evetBankFilter_t &bankFilter)
+{
+  EVETCHECKINIT(evh);
+
+  evh.bankFilter = bankFilter;
+  evh.filter = evetBankFilterMatch;
+  evh.filterArg = &evh.bankFilter;
+
+  return 0;
+}
+
+/*
+  Return only 1 event in n of those that pass the filter (0 or 1: all of
+  them), for monitoring.  The others are counted in stats.sampledOut and,
+  when forwarding, go on downstream untouched.
+*/
+int32_t
+evetSetSample(evetHandle_t &evh, uint32_t n)
+{
+  EVETCHECKINIT(evh);
+
+  evh.sampleN = n;
+  evh.sampleLeft = 1;
+
+  return 0;
+}
+
+/*
+  Sample the attached station after each get: how full its input list is,
+  and how many et_events went past it.  Those are only counted on a station
+  that should see every et_event: no prescale, ET_STATION_SELECT_ALL and
+  not in a parallel group.  actions (EVET_BP_*) say what to do
+  while it is overloaded, shed selects the events EVET_BP_SHED passes over.
+  EVET_BP_OFF stops sampling.  Must be set before prefetch is enabled.
+*/
+int32_t
+evetSetBackpressure(evetHandle_t &evh, int32_t actions, const evetBankFilter_t *shed)
+{
+  EVETCHECKINIT(evh);
+
+  if(evh.prefetch)
+    {
+      printf("%s: ERROR: must be set before prefetch is enabled\n", __func__);
+      return -1;
+    }
+
+  if(actions == EVET_BP_OFF)
+    {
+      evh.backpressure = 0;
+      evh.shedding = 0;
+      evh.bp.overloaded = 0;
+      return 0;
+    }
+
+  if((evh.fileData != NULL) || (evh.attached == 0))
+    {
+      printf("%s: ERROR: needs an attached station\n", __func__);
+      return -1;
+    }
+
+  if((actions & EVET_BP_CHUNK) && (evh.etChunkMax == 0))
+    {
+      printf("%s: ERROR: EVET_BP_CHUNK needs an adaptive chunk (evetSetAdaptiveChunk)\n",
+	     __func__);
+      return -1;
+    }
+
+  if((actions & EVET_BP_SHED) && (shed == NULL))
+    {
+      printf("%s: ERROR: EVET_BP_SHED needs a filter\n", __func__);
+      return -1;
+    }
+
+  // a blocking station's input list can hold every event in the system
+  int32_t block = 0, cue = 0, status;
+  status = et_station_getblock(evh.etSysId, evh.etStatId, &block);
+  if(status == ET_OK)
+    status = (block == ET_STATION_BLOCKING) ?
+      et_system_getnumevents(evh.etSysId, &cue) :
+      et_station_getcue(evh.etSysId, evh.etStatId, &cue);
+  if((status != ET_OK) || (cue < 1))
+    {
+      printf("%s: ERROR: station queue size unavailable (%d) %s\n",
+	     __func__, status, et_perror(status));
+      return -1;
+    }
+
+  // gaps in the block numbers are not drops if the station was never
+  // meant to get those et_events
+  int32_t prescale = 1, select = ET_STATION_SELECT_ALL, position = 0, pposition = 0;
+  status = et_station_getprescale(evh.etSysId, evh.etStatId, &prescale);
+  if(status == ET_OK)
+    status = et_station_getselect(evh.etSysId, evh.etStatId, &select);
+  if(status == ET_OK)
+    status = et_station_getposition(evh.etSysId, evh.etStatId, &position, &pposition);
+  if(status != ET_OK)
+    {
+      printf("%s: ERROR: station configuration unavailable (%d) %s\n",
+	     __func__, status, et_perror(status));
+      return -1;
+    }
+
+  memset(&evh.bp, 0, sizeof(evh.bp));
+  evh.bp.countMissed = (prescale <= 1) && (select == ET_STATION_SELECT_ALL) &&
+    (pposition == 0);
+  evh.bp.actions = actions;
+  if(shed != NULL)
+    evh.bp.shed = *shed;
+  evh.bp.cue = cue;
+  evh.shedding = 0;
+  evh.backpressure = 1;
+
+  return 0;
+}
+
+int32_t
+evetGetBackpressure(evetHandle_t &evh, evetBackpressure_t &bp)
+{
+  EVETCHECKINIT(evh);
+
+  bp = evh.bp;
+
+  return 0;
+}
+
+void
+evetPrintBackpressure(const evetBackpressure_t &bp)
+{
+  uint64_t seen = bp.blocks + bp.missed;
+
+  printf("  station input list holds %d / %d (max %d, full in %lu of %lu samples)"
+	 "  output list %d%s\n",
+	 bp.inputLevel, bp.cue, bp.maxInputLevel, bp.fullSamples, bp.samples,
+	 bp.outputLevel, bp.overloaded ? "  OVERLOADED" : "");
+  if(bp.countMissed)
+    printf("  missed %lu of %lu et_events (%.2f%%)  %.4g Hz   overloaded %lu times\n",
+	   bp.missed, seen, (seen > 0) ? 100.0 * bp.missed / seen : 0.0, bp.dropRate,
+	   bp.overloads);
+  else
+    printf("  missed et_events not counted (prescaled, selecting or parallel station)"
+	   "   overloaded %lu times\n", bp.overloads);
+}
+
+/*
+  Event formatting
+
+  evetFormatEvent renders an event into a caller buffer, so a monitor can
+  write many events with one fwrite instead of a printf per word.
+*/
+
+static inline void
+evetHex32(char *p, uint32_t value)
+{
+  static const char digit[] = "0123456789abcdef";
+  int32_t i;
+
+  p[0] = '0';
+  p[1] = 'x';
+  for(i = 0; i < 8; i++)
+    p[2 + i] = digit[(value >> (28 - 4 * i)) & 0xf];
+}
+
+static void
+evetFormatAppend(char *buf, size_t size, size_t &pos, const char *fmt, ...)
+{
+  va_list ap;
+
+  if(pos + 1 >= size)
+    return;
+
+  va_start(ap, fmt);
+  int n = vsnprintf(buf + pos, size - pos, fmt, ap);
+  va_end(ap);
+
+  // size: cut short
+  if(n > 0)
+    pos = ((size_t)n < size - pos) ? pos + n : size;
+}
+
+// nwords words as "0x%08x ", a newline after every perLine (0: none)
+static void
+evetFormatWords(char *buf, size_t size, size_t &pos, const uint32_t *data, uint32_t nwords,
+		int32_t swap, uint32_t perLine)
+{
+  uint32_t i;
+
+  if(pos >= size)
+    return;
+
+  for(i = 0; (i < nwords) && (pos + 12 < size); i++)
+    {
+      evetHex32(buf + pos, evetEventWord(data, i, swap));
+      buf[pos + 10] = ' ';
+      pos += 11;
+      if(perLine && (((i + 1) % perLine) == 0))
+	buf[pos++] = '\n';
+    }
+  buf[pos] = '\0';
+
+  // size: cut short
+  if(i < nwords)
+    pos = size;
+}
+
+static void
+evetFormatTree(char *buf, size_t size, size_t &pos, const uint32_t *data, uint32_t nwords,
+	       uint32_t type, int32_t swap, int32_t depth)
+{
+  uint32_t w, len, tag, num, childType;
+  int32_t  indent = 2 * depth;
+
+  switch(type)
+    {
+    case 0xe:
+    case 0x10: // banks
+    case 0xd:
+    case 0x20: // segments
+    case 0xc:  // tagsegments
+      while(nwords > 0)
+	{
+	  w = evetEventWord(data, 0, swap);
+	  if((type == 0xe) || (type == 0x10))
+	    {
+	      if(nwords < 2)
+		break;
+	      uint32_t w1 = evetEventWord(data, 1, swap);
+	      len = w + 1;
+	      tag = w1 >> 16;
+	      num = w1 & 0xff;
+	      childType = (w1 >> 8) & 0x3f;
+	      if((len < 2) || (len > nwords))
+		{
+		  evetFormatAppend(buf, size, pos, "%*sbad bank length %u\n", indent, "", len);
+		  return;
+		}
+	      evetFormatAppend(buf, size, pos, "%*sbank tag 0x%04x num %u type 0x%x len %u\n",
+			       indent, "", tag, num, childType, len);
+	      evetFormatTree(buf, size, pos, data + 2, len - 2, childType, swap, depth + 1);
+	    }
+	  else
+	    {
+	      len = (w & 0xffff) + 1;
+	      if(type == 0xc)
+		{
+		  tag = w >> 20;
+		  childType = (w >> 16) & 0xf;
+		}
+	      else
+		{
+		  tag = w >> 24;
+		  childType = (w >> 16) & 0x3f;
+		}
+	      if(len > nwords)
+		{
+		  evetFormatAppend(buf, size, pos, "%*sbad segment length %u\n", indent, "", len);
+		  return;
+		}
+	      evetFormatAppend(buf, size, pos, "%*s%s tag 0x%x type 0x%x len %u\n",
+			       indent, "", (type == 0xc) ? "tagsegment" : "segment",
+			       tag, childType, len);
+	      evetFormatTree(buf, size, pos, data + 1, len - 1, childType, swap, depth + 1);
+	    }
+	  data += len;
+	  nwords -= len;
+	}
+      break;
+
+    default: // data, the first words of it
+      if(nwords == 0)
+	break;
+      evetFormatAppend(buf, size, pos, "%*s", indent, "");
+      evetFormatWords(buf, size, pos, data,
+		      (nwords < EVET_FORMAT_TREE_WORDS) ? nwords : EVET_FORMAT_TREE_WORDS, swap, 0);
+      if(nwords > EVET_FORMAT_TREE_WORDS)
+	evetFormatAppend(buf, size, pos, "... (%u words)", nwords);
+      evetFormatAppend(buf, size, pos, "\n");
+      break;
+    }
+}
+
+/*
+  Render an event (length words) into buf, EVET_FORMAT_*.  swap: the event
+  is still in foreign byte order; words are shown in local order.  Returns
+  the characters written, not counting the terminating null, or size if
+  the output did not fit and was cut off (buf then holds a null
+  terminated prefix).
+*/
+size_t
+evetFormatEvent(char *buf, size_t size, const uint32_t *event, uint32_t length,
+		int32_t swap, int32_t mode)
+{
+  size_t pos = 0;
+
+  if(size == 0)
+    return 0;
+  buf[0] = '\0';
+
+  if(mode == EVET_FORMAT_TREE)
+    evetFormatTree(buf, size, pos, event, length, 0x10, swap, 0);
+  else
+    {
+      evetFormatWords(buf, size, pos, event, length, swap, 8);
+      evetFormatAppend(buf, size, pos, "\n");
+    }
+
+  return pos;
+}
+
+/*
+  timeout NULL waits for events (ET_SLEEP), a zero timeout only takes what
+  is there (ET_ASYNC), otherwise wait at most that long (ET_TIMED).
+  Returns EVET_NODATA if no events came, or the attachment was woken up.
+*/
+int32_t
+evetGetEtChunks(evetHandle_t &evh, const struct timespec *timeout)
+{
+  if(evh.verbose == 1)
+    printf("%s: enter\n", __func__);
+
+  EVETCHECKINIT(evh);
+
+  int32_t mode = ET_SLEEP;
+  struct timespec deltatime;
+  if(timeout != NULL)
+    {
+      deltatime = *timeout;
+      mode = ((deltatime.tv_sec == 0) && (deltatime.tv_nsec == 0)) ? ET_ASYNC : ET_TIMED;
+    }
+
+  uint64_t t0 = evetNowNs();
+
+  int32_t status = evetEtGet(evh, NULL, evh.etChunk, mode,
+			     (mode == ET_TIMED) ? &deltatime : NULL, &evh.etChunkNumRead);
+
+  evh.stats.waitNs += evetNowNs() - t0;
+
+  if((status == ET_ERROR_TIMEOUT) || (status == ET_ERROR_EMPTY) ||
+     (status == ET_ERROR_BUSY) || (status == ET_ERROR_WAKEUP))
+    {
+      evh.etChunkNumRead = -1;
+      return EVET_NODATA;
+    }
+
+  if(status != ET_OK)
+    {
+      printf("%s: ERROR: et_events_get returned (%d) %s\n",
+	     __func__, status, et_perror(status));
+
+      return -1;
+    }
+
+  evh.currentChunkID = -1;
+
+  return 0;
+}
+
+/*
+  Point the walker at an et_event (NULL: the mapped file), swapping it
+  first in chunk swap mode.
+*/
+static int32_t
+evetLoadChunk(evetHandle_t &evh, et_event *currentChunk)
+{
+  evh.stats.chunks++;
+  evh.chunkSeq++;
+  evh.chunkIndex = -1;
+  if(currentChunk == NULL)
+    {
+      // byte order is taken from each block header by the walker
+      evh.currentChunkStat.data = evh.fileData;
+      evh.currentChunkStat.length = evh.fileBytes;
+      evh.currentChunkStat.swap = (evh.fileData[EVIO_HDR_MAGIC] != EVIO_BLOCK_MAGIC);
+      evh.currentChunkStat.endian =
+	((__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) != evh.currentChunkStat.swap) ?
+	ET_ENDIAN_BIG : ET_ENDIAN_LITTLE;
+    }
+  else
+    {
+      et_event_getdata(currentChunk, (void **) &evh.currentChunkStat.data);
+      et_event_getlength(currentChunk, &evh.currentChunkStat.length);
+      et_event_getendian(currentChunk, &evh.currentChunkStat.endian);
+      et_event_needtoswap(currentChunk, &evh.currentChunkStat.swap);
+    }
+
+  if(evh.verbose == 1)
+    {
+      uint32_t *data = evh.currentChunkStat.data;
+      uint32_t idata = 0, len = evh.currentChunkStat.length;
+
+      printf("data byte order = %s\n",
+	     (evh.currentChunkStat.endian == ET_ENDIAN_BIG) ? "BIG" : "LITTLE");
+      printf(" %2d/%2d: data (len = %d) %s  int = %d\n",
+	     evh.currentChunkID, evh.etChunkNumRead,
+	     (int) len,
+	     evh.currentChunkStat.swap ? "needs swapping" : "does not need swapping",
+	     evh.currentChunkStat.swap ? bswap_32(data[0]) : data[0]);
+
+      for(idata = 0; idata < ((32 < (len>>2)) ? 32 : (len>>2)); idata++)
+	{
+	  printf("0x%08x ", evh.currentChunkStat.swap ? bswap_32(data[idata]) : data[idata]);
+	  if(((idata+1) % 8) == 0)
+	    printf("\n");
+	}
+      printf("\n");
+    }
+
+  if(evh.swapMode == EVET_SWAP_CHUNK)
+    {
+      int32_t stat = evetSwapChunk(evh.currentChunkStat, 1);
+      if(stat < 0)
+	{
+	  printf("%s: ERROR: bad EVIO data in chunk %d\n",
+		 __func__, evh.currentChunkID);
+	  return -1;
+	}
+
+      // later stations see it as local data
+      if((stat == 1) && (currentChunk != NULL))
+	et_event_setendian(currentChunk, ET_ENDIAN_LOCAL);
+    }
+
+  // a mapped file goes nowhere after us
+  evh.lazyChunk = ((evh.swapMode == EVET_SWAP_LAZY) && (currentChunk != NULL)) ?
+    currentChunk : NULL;
+
+  evetWalkerInit(evh.currentChunkStat);
+  evetSetNextEvent(evh);
+
+  return 0;
+}
+
+int32_t
+evetGetChunk(evetHandle_t &evh, const struct timespec *timeout)
+{
+  if(evh.verbose == 1)
+    printf("%s: enter\n", __func__);
+
+  EVETCHECKINIT(evh);
+
+  evh.currentChunkID++;
+
+  if((evh.currentChunkID >= evh.etChunkNumRead) || (evh.etChunkNumRead == -1))
+    {
+      if(evh.fileData != NULL)
+	{
+	  // the file is one chunk, served once
+	  if(evh.etChunkNumRead == 1)
+	    {
+	      evh.currentChunkID = 0;
+	      return EVET_EOF;
+	    }
+	  evh.etChunkNumRead = 1;
+	}
+      else if(evh.prefetch)
+	{
+	  // put and get happen in the prefetch thread
+	  int32_t stat = evetPrefetchSwap(evh, timeout);
+	  if(stat == EVET_NODATA)
+	    return EVET_NODATA;
+	  if(stat != 0)
+	    {
+	      printf("%s: ERROR: evetPrefetchSwap(evh) returned %d\n",
+		     __func__, stat);
+	      return -1;
+	    }
+	}
+      else
+	{
+	  if(evh.etChunkNumRead > evh.etChunkPut)
+	    {
+	      evetForwardCompact(evh, evh.etChunk + evh.etChunkPut,
+				 evh.etChunkNumRead - evh.etChunkPut);
+
+	      /* putting array of events */
+	      int32_t status = evetEtPut(evh, NULL, evh.etChunk + evh.etChunkPut,
+					 evh.etChunkNumRead - evh.etChunkPut);
+	      if (status != ET_OK)
+		{
+		  printf("%s: ERROR: et_events_put returned %s\n",
+			 __func__, et_perror(status));
+		  return -1;
+		}
+	    }
+	  evh.etChunkNumRead = -1;
+	  evh.etChunkPut = 0;
+	  evh.nDrops = 0;
+
+	  // out of chunks.  get some more
+	  int32_t stat = evetGetEtChunks(evh, timeout);
+	  if(stat == EVET_NODATA)
+	    return EVET_NODATA;
+	  if(stat != 0)
+	    {
+	      printf("%s: ERROR: evetGetEtChunks(evh) returned %d\n",
+		     __func__, stat);
+	      return -1;
+	    }
+	}
+        evh.currentChunkID++;
+
+    }
+
+  return evetLoadChunk(evh, (evh.fileData != NULL) ? NULL : evh.etChunk[evh.currentChunkID]);
+}
+
+/*
+  Lazy swap: before the et_event goes back, swap the events not walked yet
+  and the block headers, and mark it local, as chunk swap mode leaves it.
+  Otherwise a later station would find native events under foreign headers.
+*/
+static int32_t
+evetLazyFinish(evetHandle_t &evh)
+{
+  etChunkStat_t &cs = evh.currentChunkStat;
+  const uint32_t *event;
+  uint32_t length;
+  int32_t status;
+
+  while(1)
+    {
+      status = cs.swap ? evetWalkerNextT<1>(cs, &event, &length) :
+	evetWalkerNextT<0>(cs, &event, &length);
+      if(status == EVET_WALK_ORDER)
+	continue;
+      if(status != 0)
+	break;
+      if(cs.swap && (evetSwapEvent((uint32_t *) event, length) != 0))
+	{
+	  status = -1;
+	  break;
+	}
+    }
+
+  if(status == 1)
+    status = evetSwapChunk(cs, 0);
+
+  if(status < 0)
+    {
+      printf("%s: ERROR: bad EVIO data in chunk %d\n", __func__, evh.currentChunkID);
+    }
+  else if(status == 1)
+    et_event_setendian(evh.lazyChunk, ET_ENDIAN_LOCAL);
+
+  evh.lazyChunk = NULL;
+
+  return (status < 0) ? -1 : 0;
+}
+
+/*
+  Next event from the current chunk that passes the filter, swapped if in
+  lazy swap mode.  Lazy swap swaps every event walked, rejected ones too,
+  so the et_event can be finished (evetLazyFinish) at its end.
+  Returns 0 on success, 1 at the end of the chunk, -1 on bad data,
+  EVET_WALK_ORDER as evetWalkerNextT.
+*/
+template <int32_t SWAP>
+static int32_t
+evetNextEventT(evetHandle_t &evh, const uint32_t **outputBuffer, uint32_t *length)
+{
+  etChunkStat_t &cs = evh.currentChunkStat;
+  const int32_t lazy = SWAP && (evh.swapMode == EVET_SWAP_LAZY);
+  const int32_t swap = SWAP && !lazy;  // byte order the filters see
+
+  int32_t status = evetWalkerNextT<SWAP>(cs, outputBuffer, length);
+
+  while(status == 0)
+    {
+      if(lazy && (evetSwapEvent((uint32_t *) *outputBuffer, *length) != 0))
+	return -1;
+
+      if((evh.filter != NULL) &&
+	 (evh.filter(*outputBuffer, *length, swap, evh.filterArg) == 0))
+	{
+	  evh.stats.filtered++;
+	  if(evh.forward && (evetDropAdd(evh, *outputBuffer) != 0))
+	    return -1;
+	}
+      else if(evh.shedding &&
+	      evetBankFilterMatch(*outputBuffer, *length, swap, &evh.bp.shed))
+	evh.stats.shed++;
+      else if((evh.sampleN > 1) && (--evh.sampleLeft > 0))
+	evh.stats.sampledOut++;
+      else
+	break;
+
+      status = evetWalkerNextT<SWAP>(cs, outputBuffer, length);
+    }
+
+  if((status == 0) && (evh.sampleN > 1))
+    evh.sampleLeft = evh.sampleN;
+
+  if((status == 1) && (evh.lazyChunk != NULL) && (evetLazyFinish(evh) != 0))
+    return -1;
+
+  if(status == 0)
+    {
+      evh.seq = evh.nextSeq++;
+      evh.chunkIndex++;
+      evh.stats.events++;
+      evh.stats.bytes += *length * sizeof(uint32_t);
+    }
+
+  return status;
+}
+
+static inline int32_t
+evetNextEvent(evetHandle_t &evh, const uint32_t **outputBuffer, uint32_t *length)
+{
+  int32_t status = evh.nextEvent(evh, outputBuffer, length);
+
+  // a block in the other byte order than the rest of the chunk
+  while(status == EVET_WALK_ORDER)
+    {
+      evetSetNextEvent(evh);
+      status = evh.nextEvent(evh, outputBuffer, length);
+    }
+
+  return status;
+}
+
+// 1 if the event just returned is still in foreign byte order
+static inline int32_t
+evetEventSwap(const evetHandle_t &evh)
+{
+  return evh.currentChunkStat.swap && (evh.swapMode != EVET_SWAP_LAZY);
+}
+
+/*
+  Shared by evetReadNoCopy (timeout NULL), evetReadNoCopyTimed and
+  evetReadNoCopyPoll.  The timeout covers the whole call, however many
+  empty chunks are skipped.
+*/
+static int32_t
+evetReadNoCopyWait(evetHandle_t &evh, const uint32_t **outputBuffer, uint32_t *length,
+		   const struct timespec *timeout)
+{
+  EVETCHECKINIT(evh);
+
+  uint64_t deadline = 0;
+  if(timeout != NULL)
+    deadline = evetNowNs() + (uint64_t)timeout->tv_sec * 1000000000ULL + timeout->tv_nsec;
+
+  int32_t status = evetNextEvent(evh, outputBuffer, length);
+  while(status == 1)
+    {
+      struct timespec remaining, *wait = NULL;
+      if(timeout != NULL)
+	{
+	  uint64_t now = evetNowNs();
+	  uint64_t left = (deadline > now) ? deadline - now : 0;
+	  remaining.tv_sec  = left / 1000000000ULL;
+	  remaining.tv_nsec = left % 1000000000ULL;
+	  wait = &remaining;
+	}
+
+      // Get a new chunk from et_get_event
+      status = evetGetChunk(evh, wait);
+      if((status == EVET_NODATA) || (status == EVET_EOF))
+	return status;
+      if(status != 0)
+	{
+	  printf("%s: ERROR: evetGetChunk failed %d\n",
+		 __func__, status);
+	  return -1;
+	}
+
+      status = evetNextEvent(evh, outputBuffer, length);
+      if(status == 1)
+	evh.stats.emptyChunks++;
+    }
+
+  if(status != 0)
+    {
+      printf("%s: ERROR: bad EVIO data in chunk %d\n",
+	     __func__, evh.currentChunkID);
+      return -1;
+    }
+
+  return 0;
+}
+
+int32_t
+evetReadNoCopy(evetHandle_t &evh, const uint32_t **outputBuffer, uint32_t *length)
+{
+  if(evh.verbose == 1)
+    printf("%s: enter\n", __func__);
+
+  return evetReadNoCopyWait(evh, outputBuffer, length, NULL);
+}
+
+/*
+  Wait at most timeout for an event (NULL waits as long as it takes).
+  Returns EVET_NODATA if none came, so the caller can do other work and
+  try again.
+*/
+int32_t
+evetReadNoCopyTimed(evetHandle_t &evh, const uint32_t **outputBuffer, uint32_t *length,
+		    const struct timespec *timeout)
+{
+  if(evh.verbose == 1)
+    printf("%s: enter\n", __func__);
+
+  return evetReadNoCopyWait(evh, outputBuffer, length, timeout);
+}
+
+/*
+  Return an event only if one is already here (or in ET).  Never waits.
+*/
+int32_t
+evetReadNoCopyPoll(evetHandle_t &evh, const uint32_t **outputBuffer, uint32_t *length)
+{
+  if(evh.verbose == 1)
+    printf("%s: enter\n", __func__);
+
+  struct timespec zero = {0, 0};
+
+  return evetReadNoCopyWait(evh, outputBuffer, length, &zero);
+}
+
+/*
+  Fill spans with up to maxN events from what is left of the current chunk.
+  Only when nothing is left is the chunk put back and a new one fetched, so
+  every span stays valid until the next read that starts a new chunk.
+*/
+int32_t
+evetReadBatch(evetHandle_t &evh, evetSpan_t *spans, uint32_t maxN, uint32_t *nOut)
+{
+  if(evh.verbose == 1)
+    printf("%s: enter\n", __func__);
+
+  EVETCHECKINIT(evh);
+
+  uint32_t n = 0;
+  int32_t newChunk = 0;
+  while(n < maxN)
+    {
+      int32_t status = evetNextEvent(evh, &spans[n].data, &spans[n].length);
+      if(status == 0)
+	{
+	  spans[n].seq = evh.seq;
+	  spans[n].swap = evetEventSwap(evh);
+	  n++;
+	  newChunk = 0;
+	  continue;
+	}
+
+      if((status == 1) && newChunk)
+	evh.stats.emptyChunks++;
+
+      if(status != 1)
+	{
+	  printf("%s: ERROR: bad EVIO data in chunk %d\n",
+		 __func__, evh.currentChunkID);
+	  *nOut = n;
+	  return -1;
+	}
+
+      // Going past the last et_event would put back events already in spans
+      if((n > 0) && ((evh.currentChunkID + 1) >= evh.etChunkNumRead))
+	break;
+
+      status = evetGetChunk(evh, NULL);
+      if(status == EVET_EOF)
+	{
+	  *nOut = n;
+	  return (n > 0) ? 0 : EVET_EOF;
+	}
+      if(status != 0)
+	{
+	  printf("%s: ERROR: evetGetChunk failed %d\n",
+		 __func__, status);
+	  *nOut = n;
+	  return -1;
+	}
+      newChunk = 1;
+    }
+
+  *nOut = n;
+
+  return 0;
+}
+
+/*
+  Copy into an arena
+
+  evetReadCopy copies events out of the et_events, so each et_event can go
+  back to ET as soon as its last event is copied, however long the
+  analysis of the copies takes.  The arena is a bump allocator: copies
+  stay valid until evetArenaReset, typically once per batch.
+*/
+
+int32_t
+evetArenaInit(evetArena_t &arena, size_t size)
+{
+  memset(&arena, 0, sizeof(arena));
+
+  void *base = evetAllocBuffer(size);
+  if(base == NULL)
+    {
+      printf("%s: out of memory\n", __func__);
+      return -1;
+    }
+
+  arena.base = (uint8_t *) base;
+  arena.size = size;
+
+  return 0;
+}
+
+void
+evetArenaReset(evetArena_t &arena)
+{
+  arena.used = 0;
+}
+
+void
+evetArenaFree(evetArena_t &arena)
+{
+  evetFreeBuffer(arena.base, arena.size);
+  memset(&arena, 0, sizeof(arena));
+}
+
+/*
+  Copy nbytes (a multiple of 4) to dst, aligned to EVET_ARENA_ALIGN.  Big
+  events bypass the cache on the way in, so they don't evict the working
+  set; the caller fences once after a batch of them.
+*/
+static inline void
+evetCopyEvent(uint8_t *dst, const uint32_t *src, size_t nbytes)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  if(nbytes >= EVET_COPY_STREAM_BYTES)
+    {
+      size_t i = 0;
+      for(; (i + 64) <= nbytes; i += 64)
+	{
+	  const __m128i *s = (const __m128i *) ((const uint8_t *) src + i);
+	  __m128i *d = (__m128i *) (dst + i);
+	  __m128i v0 = _mm_loadu_si128(s);
+	  __m128i v1 = _mm_loadu_si128(s + 1);
+	  __m128i v2 = _mm_loadu_si128(s + 2);
+	  __m128i v3 = _mm_loadu_si128(s + 3);
+	  _mm_stream_si128(d, v0);
+	  _mm_stream_si128(d + 1, v1);
+	  _mm_stream_si128(d + 2, v2);
+	  _mm_stream_si128(d + 3, v3);
+	}
+      memcpy(dst + i, (const uint8_t *) src + i, nbytes - i);
+      return;
+    }
+#endif
+
+  memcpy(dst, src, nbytes);
+}
+
+// Put back the et_events before done that have not gone back yet
+static int32_t
+evetPutDone(evetHandle_t &evh, int32_t done)
+{
+  if((evh.fileData != NULL) || (done <= evh.etChunkPut))
+    return 0;
+
+  evetForwardCompact(evh, evh.etChunk + evh.etChunkPut, done - evh.etChunkPut);
+
+  int32_t status = evetEtPut(evh, NULL, evh.etChunk + evh.etChunkPut, done - evh.etChunkPut);
+  if(status != ET_OK)
+    {
+      printf("%s: ERROR: et_events_put returned %s\n",
+	     __func__, et_perror(status));
+      return -1;
+    }
+  evh.etChunkPut = done;
+
+  return 0;
+}
+
+/*
+  Copy up to maxN events into the arena, filling spans with the copies,
+  and put back every et_event that has been copied in full.  Stops early
+  when the arena is full.  Waits (up to timeout, NULL: as long as it
+  takes) only while no event has been copied; after that only what is
+  already there is taken.  Returns EVET_NODATA or EVET_EOF if no events
+  were copied.
+*/
+int32_t
+evetReadCopy(evetHandle_t &evh, evetArena_t &arena, evetSpan_t *spans, uint32_t maxN,
+	     uint32_t *nOut, const struct timespec *timeout)
+{
+  if(evh.verbose == 1)
+    printf("%s: enter\n", __func__);
+
+  EVETCHECKINIT(evh);
+
+  struct timespec zero = {0, 0};
+  int32_t done = evh.etChunkPut, streamed = 0, rval = 0;
+  uint32_t n = 0;
+
+  while(n < maxN)
+    {
+      const uint32_t *data;
+      uint32_t length;
+      uint64_t seq;
+      int32_t swap = 0, status = 0;
+
+      if(evh.heldData != NULL)
+	{
+	  data = evh.heldData;
+	  length = evh.heldLength;
+	  seq = evh.heldSeq;
+	  swap = evh.heldSwap;
+	  evh.heldData = NULL;
+	}
+      else
+	{
+	  status = evetNextEvent(evh, &data, &length);
+	  seq = evh.seq;
+	  swap = evetEventSwap(evh);
+	}
+
+      if(status == 0)
+	{
+	  size_t nbytes = (size_t)length * sizeof(uint32_t);
+	  size_t start = (arena.used + EVET_ARENA_ALIGN - 1) & ~((size_t)EVET_ARENA_ALIGN - 1);
+
+	  if(start + nbytes > arena.size)
+	    {
+	      // keep it for the next call, after the arena is reset
+	      evh.heldData = data;
+	      evh.heldLength = length;
+	      evh.heldSeq = seq;
+	      evh.heldSwap = swap;
+	      if((n == 0) && (arena.used == 0))
+		{
+		  printf("%s: ERROR: event of %d words is bigger than the arena\n",
+			 __func__, length);
+		  rval = -1;
+		}
+	      break;
+	    }
+
+	  evetCopyEvent(arena.base + start, data, nbytes);
+	  if(nbytes >= EVET_COPY_STREAM_BYTES)
+	    streamed = 1;
+	  arena.used = start + nbytes;
+
+	  spans[n].data = (const uint32_t *) (arena.base + start);
+	  spans[n].length = length;
+	  spans[n].seq = seq;
+	  spans[n].swap = swap;
+	  n++;
+	  continue;
+	}
+
+      if(status != 1)
+	{
+	  printf("%s: ERROR: bad EVIO data in chunk %d\n",
+		 __func__, evh.currentChunkID);
+	  rval = -1;
+	  break;
+	}
+
+      // this et_event has been copied
+      if((evh.currentChunkID >= 0) && (evh.currentChunkID < evh.etChunkNumRead))
+	done = evh.currentChunkID + 1;
+
+      // put back what is done before moving on to a new et_event array
+      if((evh.currentChunkID + 1) >= evh.etChunkNumRead)
+	{
+	  if(evetPutDone(evh, done) != 0)
+	    {
+	      rval = -1;
+	      break;
+	    }
+	  done = 0;
+	}
+
+      status = evetGetChunk(evh, (n > 0) ? &zero : timeout);
+      if((status == EVET_NODATA) || (status == EVET_EOF))
+	{
+	  if(n == 0)
+	    rval = status;
+	  break;
+	}
+      if(status != 0)
+	{
+	  printf("%s: ERROR: evetGetChunk failed %d\n",
+		 __func__, status);
+	  rval = -1;
+	  break;
+	}
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+  if(streamed)
+    _mm_sfence();
+#endif
+
+  *nOut = n;
+
+  if((rval == 0) && (evetPutDone(evh, done) != 0))
+    rval = -1;
+
+  return rval;
+}
+
+/*
+  Forwarding
+
+  With evetSetForward, events dropped with evetDropEvent, and events the
+  filter rejects, are taken out of their et_event before it is put: the
+  events and blocks after them are moved down in place and the block
+  headers (and v6 index) rewritten.  The et_event goes on to the next
+  station holding only the events that were kept, without a copy into a
+  separate producer.
+*/
+
+int32_t
+evetSetForward(evetHandle_t &evh, int32_t enable)
+{
+  EVETCHECKINIT(evh);
+
+  if(evh.fileData != NULL)
+    {
+      printf("%s: ERROR: reading from a file\n", __func__);
+      return -1;
+    }
+
+  // a lazily swapped event no longer has the byte order of its block
+  if(enable && (evh.swapMode == EVET_SWAP_LAZY))
+    {
+      printf("%s: ERROR: not with swap mode EVET_SWAP_LAZY\n", __func__);
+      return -1;
+    }
+
+  evh.forward = enable ? 1 : 0;
+
+  return 0;
+}
+
+static int32_t
+evetDropAdd(evetHandle_t &evh, const uint32_t *event)
+{
+  if(evh.nDrops == evh.maxDrops)
+    {
+      uint32_t max = evh.maxDrops ? 2 * evh.maxDrops : 64;
+      const uint32_t **drops =
+	(const uint32_t **) realloc(evh.drops, max * sizeof(const uint32_t *));
+      if(drops == NULL)
+	{
+	  printf("%s: out of memory\n", __func__);
+	  return -1;
+	}
+      evh.drops = drops;
+      evh.maxDrops = max;
+    }
+
+  evh.drops[evh.nDrops++] = event;
+
+  return 0;
+}
+
+/*
+  Leave event (as returned by a read) out of its et_event when that is put.
+  Only events of et_events the handle still holds can be dropped.
+*/
+int32_t
+evetDropEvent(evetHandle_t &evh, const uint32_t *event)
+{
+  EVETCHECKINIT(evh);
+
+  if(evh.forward == 0)
+    {
+      printf("%s: ERROR: forwarding not enabled (evetSetForward)\n", __func__);
+      return -1;
+    }
+
+  int32_t i;
+  for(i = evh.etChunkPut; i < evh.etChunkNumRead; i++)
+    {
+      uint32_t *data;
+      size_t length;
+
+      et_event_getdata(evh.etChunk[i], (void **) &data);
+      et_event_getlength(evh.etChunk[i], &length);
+      if((event >= data) && (event < data + (length >> 2)))
+	return evetDropAdd(evh, event);
+    }
+
+  printf("%s: ERROR: event is not in an et_event held by this handle\n", __func__);
+  return -1;
+}
+
+static int
+evetDropCompare(const void *a, const void *b)
+{
+  const uint32_t *x = *(const uint32_t * const *) a;
+  const uint32_t *y = *(const uint32_t * const *) b;
+
+  return (x < y) ? -1 : (x > y);
+}
+
+static inline void
+evetPutWord(uint32_t *p, uint32_t value, int32_t swap)
+{
+  *p = swap ? bswap_32(value) : value;
+}
+
+/*
+  Take the events in drops (n, sorted) out of an et_event's data.
+  Returns the new length in bytes, or 0 on bad data (data is unchanged).
+*/
+static size_t
+evetForwardData(uint32_t *data, size_t nbytes, const uint32_t **drops, uint32_t n)
+{
+  etChunkStat_t w;
+  int32_t status;
+
+  memset(&w, 0, sizeof(w));
+  w.data = data;
+  w.length = nbytes;
+
+  // check all of it first, it is changed block by block
+  evetWalkerInit(w);
+  while((status = evetWalkerNextBlock(w)) == 0)
+    {
+      const uint32_t *e = w.next;
+      uint32_t k;
+      for(k = 0; k < w.blockEventsLeft; k++)
+	{
+	  if(e >= w.blockEnd)
+	    return 0;
+	  uint32_t len = evetEventWord(e, 0, w.swap) + 1;
+	  if((size_t)(w.blockEnd - e) < len)
+	    return 0;
+	  e += len;
+	}
+      w.blockEventsLeft = 0;
+    }
+  if(status < 0)
+    return 0;
+
+  uint32_t *dst = data;
+  uint32_t id = 0;
+
+  evetWalkerInit(w);
+  while(1)
+    {
+      uint32_t *header = w.blockEnd;
+      if(evetWalkerNextBlock(w) != 0)
+	break;
+
+      int32_t  swap = w.swap;
+      uint32_t *events = w.next;
+      uint32_t count = w.blockEventsLeft;
+      w.blockEventsLeft = 0;
+
+      // a v6 file header is kept as it is
+      if(evetEventWord(header, EVIO_HDR_LENGTH, swap) == EVIO_FILE_ID)
+	{
+	  memmove(dst, header, (events - header) * sizeof(uint32_t));
+	  dst += events - header;
+	  continue;
+	}
+
+      uint32_t headerLength = evetEventWord(header, EVIO_HDR_HEADERLENGTH, swap);
+      uint32_t version = evetEventWord(header, EVIO_HDR_BITINFO, swap) & 0xff;
+      uint32_t indexWords = (version >= 6) ?
+	(evetEventWord(header, EVIO_HDR_INDEXLENGTH, swap) >> 2) : 0;
+      uint32_t userWords = (events - header) - headerLength - indexWords;
+
+      // events kept, for the size of the new index
+      const uint32_t *e = events;
+      uint32_t k, j = id, kept = 0;
+      for(k = 0; k < count; k++)
+	{
+	  while((j < n) && (drops[j] < e))
+	    j++;
+	  if((j < n) && (drops[j] == e))
+	    j++;
+	  else
+	    kept++;
+	  e += evetEventWord(e, 0, swap) + 1;
+	}
+
+      // header, index, user header, events; each moves down, never up
+      uint32_t *out = dst;
+      memmove(out, header, headerLength * sizeof(uint32_t));
+      out += headerLength;
+      uint32_t *index = out;
+      if(indexWords > 0)
+	out += kept;
+      memmove(out, header + headerLength + indexWords, userWords * sizeof(uint32_t));
+      out += userWords;
+
+      uint32_t *in = events;
+      for(k = 0; k < count; k++)
+	{
+	  uint32_t len = evetEventWord(in, 0, swap) + 1;
+	  while((id < n) && (drops[id] < in))
+	    id++;
+	  if((id < n) && (drops[id] == in))
+	    id++;
+	  else
+	    {
+	      memmove(out, in, len * sizeof(uint32_t));
+	      if(indexWords > 0)
+		evetPutWord(index++, len * sizeof(uint32_t), swap);
+	      out += len;
+	    }
+	  in += len;
+	}
+
+      evetPutWord(&dst[EVIO_HDR_LENGTH], out - dst, swap);
+      evetPutWord(&dst[EVIO_HDR_COUNT], kept, swap);
+      if(version >= 6)
+	{
+	  // index length, and uncompressed data length (bytes)
+	  evetPutWord(&dst[EVIO_HDR_INDEXLENGTH], (indexWords > 0) ? kept * sizeof(uint32_t) : 0, swap);
+	  evetPutWord(&dst[8], (out - dst - headerLength) * sizeof(uint32_t), swap);
+	}
+
+      dst = out;
+    }
+
+  return (size_t)(dst - data) * sizeof(uint32_t);
+}
+
+/*
+  Take the dropped events out of the n et_events at pe, before they are put.
+*/
+static int32_t
+evetForwardCompact(evetHandle_t &evh, et_event **pe, int32_t n)
+{
+  if(evh.nDrops == 0)
+    return 0;
+
+  qsort(evh.drops, evh.nDrops, sizeof(const uint32_t *), evetDropCompare);
+
+  int32_t i, rval = 0;
+  for(i = 0; i < n; i++)
+    {
+      uint32_t *data;
+      size_t length;
+
+      et_event_getdata(pe[i], (void **) &data);
+      et_event_getlength(pe[i], &length);
+
+      // drops in this et_event, [lo, hi)
+      uint32_t lo = 0, hi, top = evh.nDrops;
+      while(lo < top)
+	{
+	  uint32_t mid = (lo + top) / 2;
+	  if(evh.drops[mid] < data)
+	    lo = mid + 1;
+	  else
+	    top = mid;
+	}
+      for(hi = lo; (hi < evh.nDrops) && (evh.drops[hi] < data + (length >> 2)); hi++);
+      if(hi == lo)
+	continue;
+
+      size_t nbytes = evetForwardData(data, length, evh.drops + lo, hi - lo);
+      if(nbytes == 0)
+	{
+	  printf("%s: ERROR: bad EVIO data, et_event forwarded as it is\n", __func__);
+	  rval = -1;
+	}
+      else
+	et_event_setlength(pe[i], nbytes);
+
+      // mark them done in bit 0, which keeps the order
+      for(; lo < hi; lo++)
+	evh.drops[lo] = (const uint32_t *)((uintptr_t) evh.drops[lo] | 1);
+    }
+
+  // keep the drops of et_events not put yet
+  uint32_t id, keep = 0;
+  for(id = 0; id < evh.nDrops; id++)
+    if(((uintptr_t) evh.drops[id] & 1) == 0)
+      evh.drops[keep++] = evh.drops[id];
+  evh.nDrops = keep;
+
+  return rval;
+}
+
+/*
+  CODA event decoding
+
+  A built physics event is a bank of banks, num M events, whose first
+  child is the built trigger bank (a bank of segments, num ROCs):
+    - 64 bit segment: first event number, M timestamps if the trigger
+      tag has EVET_CODA_TRIG_TIMESTAMP, run number and type if it has
+      EVET_CODA_TRIG_RUNINFO
+    - 16 bit segment: M event types
+    - one segment per ROC
+  followed by one data bank per ROC, tagged with the ROC id.  Only the
+  headers are read, the ROC data is left where it is.
+*/
+
+static inline uint64_t
+evetCodaWord64(const uint32_t *p, int32_t swap)
+{
+  return swap ? (((uint64_t)bswap_32(p[0]) << 32) | bswap_32(p[1]))
+    : (((uint64_t)p[1] << 32) | p[0]);
+}
+
+static inline uint16_t
+evetCodaShort(const uint32_t *p, uint32_t k, int32_t swap)
+{
+  uint16_t v = ((const uint16_t *) p)[k];
+  return swap ? bswap_16(v) : v;
+}
+
+int32_t
+evetCodaSoAInit(evetCodaSoA_t &soa, uint32_t capacity, uint32_t maxRoc)
+{
+  memset(&soa, 0, sizeof(soa));
+
+  if((capacity < 1) || (maxRoc < 1))
+    {
+      printf("%s: ERROR: invalid capacity %d or max ROCs %d\n",
+	     __func__, capacity, maxRoc);
+      return -1;
+    }
+
+  soa.capacity = capacity;
+  soa.maxRoc = maxRoc;
+
+  soa.eventNumber = (uint64_t *) evetAllocBuffer(capacity * sizeof(uint64_t));
+  soa.timestamp   = (uint64_t *) evetAllocBuffer(capacity * sizeof(uint64_t));
+  soa.eventType   = (uint16_t *) evetAllocBuffer(capacity * sizeof(uint16_t));
+  soa.event       = (const uint32_t **) evetAllocBuffer(capacity * sizeof(uint32_t *));
+  soa.rocId       = (uint32_t *) evetAllocBuffer(maxRoc * sizeof(uint32_t));
+  soa.rocOffset   = (uint32_t *) evetAllocBuffer((size_t)maxRoc * capacity * sizeof(uint32_t));
+  soa.rocLength   = (uint32_t *) evetAllocBuffer((size_t)maxRoc * capacity * sizeof(uint32_t));
+
+  if((soa.eventNumber == NULL) || (soa.timestamp == NULL) || (soa.eventType == NULL) ||
+     (soa.event == NULL) || (soa.rocId == NULL) || (soa.rocOffset == NULL) ||
+     (soa.rocLength == NULL))
+    {
+      printf("%s: out of memory\n", __func__);
+      evetCodaSoAFree(soa);
+      return -1;
+    }
+
+  return 0;
+}
+
+/*
+  Empty the arrays for the next batch.  The ROC columns stay as they are.
+*/
+void
+evetCodaSoAClear(evetCodaSoA_t &soa)
+{
+  uint32_t ir;
+
+  for(ir = 0; ir < soa.nRoc; ir++)
+    {
+      memset(&soa.rocOffset[ir * soa.capacity], 0, soa.n * sizeof(uint32_t));
+      memset(&soa.rocLength[ir * soa.capacity], 0, soa.n * sizeof(uint32_t));
+    }
+  soa.n = 0;
+}
+
+void
+evetCodaSoAFree(evetCodaSoA_t &soa)
+{
+  size_t column = (size_t)soa.maxRoc * soa.capacity * sizeof(uint32_t);
+
+  evetFreeBuffer(soa.eventNumber, soa.capacity * sizeof(uint64_t));
+  evetFreeBuffer(soa.timestamp, soa.capacity * sizeof(uint64_t));
+  evetFreeBuffer(soa.eventType, soa.capacity * sizeof(uint16_t));
+  evetFreeBuffer((void *) soa.event, soa.capacity * sizeof(uint32_t *));
+  evetFreeBuffer(soa.rocId, soa.maxRoc * sizeof(uint32_t));
+  evetFreeBuffer(soa.rocOffset, column);
+  evetFreeBuffer(soa.rocLength, column);
+  memset(&soa, 0, sizeof(soa));
+}
+
+static inline int32_t
+evetCodaRocColumn(evetCodaSoA_t &soa, uint32_t id)
+{
+  uint32_t ir;
+
+  for(ir = 0; ir < soa.nRoc; ir++)
+    if(soa.rocId[ir] == id)
+      return ir;
+
+  if(soa.nRoc == soa.maxRoc)
+    return -1;
+
+  soa.rocId[soa.nRoc] = id;
+  return soa.nRoc++;
+}
+
+/*
+  Add the M entries of one event (swap: still in foreign byte order).
+  Anything but a built physics event is counted in skipped.
+  Returns 0, or -1 on bad data or if the entries don't fit.
+*/
+int32_t
+evetCodaDecode(evetCodaSoA_t &soa, const uint32_t *event, uint32_t length, int32_t swap)
+{
+  if(length < 2)
+    return -1;
+
+  uint32_t header = evetEventWord(event, 1, swap);
+  uint32_t tag = header >> 16, type = (header >> 8) & 0x3f, M = header & 0xff;
+
+  if((tag < EVET_CODA_PHYSICS_MIN) || (tag > EVET_CODA_PHYSICS_MAX) ||
+     ((type != 0xe) && (type != 0x10)))
+    {
+      soa.skipped++;
+      return 0;
+    }
+
+  if(length < 4)
+    {
+      printf("%s: ERROR: physics event of length %d\n", __func__, length);
+      return -1;
+    }
+
+  if(soa.n + M > soa.capacity)
+    {
+      printf("%s: ERROR: no room for %d more entries\n", __func__, M);
+      return -1;
+    }
+
+  // built trigger bank
+  const uint32_t *trig = &event[2];
+  uint32_t trigLength = evetEventWord(trig, 0, swap) + 1;
+  uint32_t trigTag = evetEventWord(trig, 1, swap) >> 16;
+
+  if((trigLength < 2) || (trigLength > length - 2) ||
+     (trigTag < EVET_CODA_TRIGGER_MIN) || (trigTag > EVET_CODA_TRIGGER_MAX))
+    {
+      printf("%s: ERROR: no built trigger bank (tag 0x%x)\n", __func__, trigTag);
+      return -1;
+    }
+
+  uint32_t i0 = soa.n, k;
+  uint32_t pos = 2;           // segments in the trigger bank
+  int32_t  iseg = 0;
+
+  for(k = 0; k < M; k++)
+    {
+      soa.event[i0 + k] = event;
+      soa.timestamp[i0 + k] = 0;
+      soa.eventType[i0 + k] = 0;
+    }
+
+  while(pos < trigLength)
+    {
+      uint32_t seg = evetEventWord(trig, pos, swap);
+      uint32_t segLength = seg & 0xffff, segType = (seg >> 16) & 0x3f;
+      const uint32_t *data = &trig[pos + 1];
+
+      if(pos + 1 + segLength > trigLength)
+	{
+	  printf("%s: ERROR: trigger segment overruns its bank\n", __func__);
+	  return -1;
+	}
+
+      if((iseg == 0) && (segType == 0xa))
+	{
+	  // event number, timestamps, run info
+	  uint32_t need = 2 + ((trigTag & EVET_CODA_TRIG_TIMESTAMP) ? 2 * M : 0) +
+	    ((trigTag & EVET_CODA_TRIG_RUNINFO) ? 2 : 0);
+	  if(segLength < need)
+	    {
+	      printf("%s: ERROR: short event number segment\n", __func__);
+	      return -1;
+	    }
+
+	  uint64_t first = evetCodaWord64(data, swap);
+	  for(k = 0; k < M; k++)
+	    soa.eventNumber[i0 + k] = first + k;
+	  data += 2;
+
+	  if(trigTag & EVET_CODA_TRIG_TIMESTAMP)
+	    {
+	      for(k = 0; k < M; k++)
+		soa.timestamp[i0 + k] = evetCodaWord64(&data[2 * k], swap);
+	      data += 2 * M;
+	    }
+
+	  if(trigTag & EVET_CODA_TRIG_RUNINFO)
+	    {
+	      uint64_t run = evetCodaWord64(data, swap);
+	      soa.runNumber = run >> 32;
+	      soa.runType = run & 0xffffffff;
+	    }
+	}
+      else if((iseg == 1) && (segType == 0x5))
+	{
+	  if(2 * segLength < M)
+	    {
+	      printf("%s: ERROR: short event type segment\n", __func__);
+	      return -1;
+	    }
+	  for(k = 0; k < M; k++)
+	    soa.eventType[i0 + k] = evetCodaShort(data, k, swap);
+	}
+
+      pos += 1 + segLength;
+      iseg++;
+    }
+
+  // ROC banks
+  pos = 2 + trigLength;
+  while(pos + 1 < length)
+    {
+      uint32_t rocLength = evetEventWord(event, pos, swap) + 1;
+      if((rocLength < 2) || (rocLength > length - pos))
+	{
+	  printf("%s: ERROR: ROC bank overruns the event\n", __func__);
+	  return -1;
+	}
+
+      int32_t ir = evetCodaRocColumn(soa, evetEventWord(event, pos + 1, swap) >> 16);
+      if(ir < 0)
+	soa.rocOverflow++;
+      else
+	for(k = 0; k < M; k++)
+	  {
+	    soa.rocOffset[ir * soa.capacity + i0 + k] = pos;
+	    soa.rocLength[ir * soa.capacity + i0 + k] = rocLength;
+	  }
+
+      pos += rocLength;
+    }
+
+  soa.n += M;
+
+  return 0;
+}
+
+/*
+  Decode the events of a batch, e.g. from evetReadBatch, each in the byte
+  order of its span (its et_event may differ from the others').  Stops at
+  the first event that fails; *nDone says how many were decoded.
+*/
+int32_t
+evetCodaDecodeBatch(evetCodaSoA_t &soa, const evetSpan_t *spans, uint32_t n,
+		    uint32_t *nDone)
+{
+  uint32_t i;
+
+  for(i = 0; i < n; i++)
+    {
+      if(evetCodaDecode(soa, spans[i].data, spans[i].length, spans[i].swap) != 0)
+	break;
+    }
+
+  *nDone = i;
+
+  return (i == n) ? 0 : -1;
+}
+
+/*
+  Multi-source reader
+
+  Each source is an attached evetHandle.  Sources take turns, each giving
+  up to its quantum of events per turn, read with non-blocking gets, so a
+  busy source can't starve a slow one and no source needs its own thread.
+  When a whole round finds nothing, sleep a little and go round again.
+  A paused source is left alone; its station backs up, and with a
+  blocking station so do its producers.
+*/
+
+int32_t
+evetMultiOpen(evetMulti_t &mh, int32_t maxSources)
+{
+  memset(&mh, 0, sizeof(mh));
+
+  if(maxSources < 1)
+    {
+      printf("%s: ERROR: invalid number of sources (%d)\n", __func__, maxSources);
+      return -1;
+    }
+
+  mh.source = (evetMultiSource_t *) calloc((size_t)maxSources, sizeof(evetMultiSource_t));
+  if (mh.source == NULL) {
+    printf("%s: out of memory\n", __func__);
+    return -1;
+  }
+  mh.maxSources = maxSources;
+
+  return 0;
+}
+
+/*
+  Add an open, attached handle.  quantum 0 takes the handle's chunk size.
+  Returns the source number, or -1.
+*/
+int32_t
+evetMultiAdd(evetMulti_t &mh, evetHandle_t &evh, int32_t quantum)
+{
+  EVETCHECKINIT(evh);
+
+  if(mh.nSources >= mh.maxSources)
+    {
+      printf("%s: ERROR: already %d sources\n", __func__, mh.nSources);
+      return -1;
+    }
+
+  evetMultiSource_t &src = mh.source[mh.nSources];
+  src.evh = &evh;
+  src.quantum = (quantum > 0) ? quantum : evh.etChunkSize;
+  src.paused = 0;
+  src.turns = 0;
+  src.emptyPolls = 0;
+
+  if(mh.nSources == 0)
+    mh.credit = src.quantum;
+
+  return mh.nSources++;
+}
+
+int32_t
+evetMultiSetPaused(evetMulti_t &mh, int32_t source, int32_t paused)
+{
+  if((source < 0) || (source >= mh.nSources))
+    {
+      printf("%s: ERROR: invalid source %d\n", __func__, source);
+      return -1;
+    }
+
+  mh.source[source].paused = paused;
+
+  return 0;
+}
+
+/*
+  Next event from any source, and which source it came from.  timeout as
+  for evetReadNoCopyTimed.  Returns EVET_EOF once every source that is not
+  paused is a file that has been read to the end.
+*/
+int32_t
+evetMultiRead(evetMulti_t &mh, const uint32_t **outputBuffer, uint32_t *length,
+	      int32_t *source, const struct timespec *timeout)
+{
+  if(mh.nSources == 0)
+    {
+      printf("%s: ERROR: no sources\n", __func__);
+      return -1;
+    }
+
+  uint64_t deadline = 0;
+  if(timeout != NULL)
+    deadline = evetNowNs() + (uint64_t)timeout->tv_sec * 1000000000ULL + timeout->tv_nsec;
+
+  while(1)
+    {
+      int32_t tries, polled = 0, eof = 0;
+      for(tries = 0; tries < mh.nSources; tries++)
+	{
+	  evetMultiSource_t &src = mh.source[mh.current];
+
+	  if(src.paused == 0)
+	    {
+	      polled++;
+	      int32_t status = evetReadNoCopyPoll(*src.evh, outputBuffer, length);
+	      if(status == 0)
+		{
+		  if(mh.credit == src.quantum)
+		    src.turns++;
+		  *source = mh.current;
+		  if(--mh.credit > 0)
+		    return 0;
+
+		  // turn used up: the next source goes first next time
+		  mh.current = (mh.current + 1) % mh.nSources;
+		  mh.credit = mh.source[mh.current].quantum;
+		  return 0;
+		}
+
+	      if(status == EVET_EOF)
+		eof++;
+	      else if(status != EVET_NODATA)
+		{
+		  printf("%s: ERROR: source %d returned %d\n",
+			 __func__, mh.current, status);
+		  *source = mh.current;
+		  return -1;
+		}
+
+	      if(mh.credit == src.quantum)
+		src.emptyPolls++;
+	    }
+
+	  mh.current = (mh.current + 1) % mh.nSources;
+	  mh.credit = mh.source[mh.current].quantum;
+	}
+
+      // a paused source does not hold off the end
+      if((polled > 0) && (eof == polled))
+	return EVET_EOF;
+
+      uint64_t sleepNs = EVET_MULTI_IDLE_NS;
+      if(timeout != NULL)
+	{
+	  uint64_t now = evetNowNs();
+	  if(now >= deadline)
+	    return EVET_NODATA;
+	  if(deadline - now < sleepNs)
+	    sleepNs = deadline - now;
+	}
+
+      struct timespec ts = {0, (long)sleepNs};
+      nanosleep(&ts, NULL);
+      mh.idleNs += sleepNs;
+    }
+}
+
+void
+evetMultiPrintStats(const evetMulti_t &mh)
+{
+  int32_t is;
+
+  printf("  %d sources, idle %.3f s\n", mh.nSources, 1e-9 * mh.idleNs);
+  for(is = 0; is < mh.nSources; is++)
+    {
+      const evetMultiSource_t &src = mh.source[is];
+
+      printf(" source %d%s: turns %lu  empty polls %lu\n",
+	     is, src.paused ? " (paused)" : "", src.turns, src.emptyPolls);
+      evetPrintStats(src.evh->stats);
+    }
+}
+
+/*
+  The handles stay open, to be closed by the caller
+*/
+int32_t
+evetMultiClose(evetMulti_t &mh)
+{
+  if(mh.source)
+    free(mh.source);
+  mh.source = NULL;
+  mh.nSources = 0;
+
+  return 0;
+}
+
+/*
+  Worker pool: one station per worker in a group of parallel stations,
+  each worker reading with its own evetHandle on its own thread.
+*/
+
+int32_t
+evetPoolOpen(et_sys_id etSysId, const char *stationName, et_statconfig sconfig,
+	     int32_t position, int32_t nWorkers, int32_t chunk, evetPool_t &pool)
+{
+  pool.etSysId = etSysId;
+  pool.nWorkers = 0;
+  pool.callback = NULL;
+  pool.arg = NULL;
+  pool.running = 0;
+  pool.quit = 0;
+  pool.pinWorkers = 0;
+
+  if(nWorkers < 1)
+    {
+      printf("%s: ERROR: invalid number of workers (%d)\n",
+	     __func__, nWorkers);
+      return -1;
+    }
+
+  pool.worker = (evetPoolWorker_t *) calloc((size_t)nWorkers, sizeof(evetPoolWorker_t));
+  if (pool.worker == NULL) {
+    printf("%s: out of memory\n", __func__);
+    return -1;
+  }
+
+  // Default to spreading events evenly over the group
+  et_statconfig config = sconfig;
+  if(sconfig == NULL)
+    {
+      et_station_config_init(&config);
+      et_station_config_setselect(config, ET_STATION_SELECT_EQUALCUE);
+    }
+  et_station_config_setflow(config, ET_STATION_PARALLEL);
+
+  int32_t rval = 0, iw;
+  for(iw = 0; iw < nWorkers; iw++)
+    {
+      evetPoolWorker_t &w = pool.worker[iw];
+      char name[ET_STATNAME_LENGTH];
+
+      snprintf(name, sizeof(name), "%s_%d", stationName, iw);
+      w.pool = &pool;
+      w.id = iw;
+
+      int32_t status = et_station_create_at(etSysId, &w.etStatId, name, config,
+					    position, ET_END);
+      if((status != ET_OK) && (status != ET_ERROR_EXISTS))
+	{
+	  printf("%s: ERROR: et_station_create_at(%s) returned %s\n",
+		 __func__, name, et_perror(status));
+	  rval = -1;
+	  break;
+	}
+
+      // the rest of the group goes where the first station ended up
+      if(iw == 0)
+	{
+	  int32_t ppos;
+	  et_station_getposition(etSysId, w.etStatId, &position, &ppos);
+	}
+
+      if(evetOpen(etSysId, chunk, w.evh) != 0)
+	{
+	  rval = -1;
+	  break;
+	}
+
+      if(evetAttach(w.evh, w.etStatId) != 0)
+	{
+	  evetClose(w.evh);
+	  rval = -1;
+	  break;
+	}
+
+      pool.nWorkers++;
+    }
+
+  if(sconfig == NULL)
+    et_station_config_destroy(config);
+
+  if(rval != 0)
+    evetPoolClose(pool);
+
+  return rval;
+}
+
+static void *
+evetPoolWorkerThread(void *arg)
+{
+  evetPoolWorker_t *w = (evetPoolWorker_t *) arg;
+  evetPool_t *pool = w->pool;
+
+  while(pool->quit == 0)
+    {
+      const uint32_t *buf;
+      uint32_t len;
+
+      if(evetReadNoCopy(w->evh, &buf, &len) != 0)
+	{
+	  // a wakeup from evetPoolClose is not an error
+	  if(pool->quit == 0)
+	    w->status = -1;
+	  break;
+	}
+
+      if((*pool->callback)(w->id, buf, len, pool->arg) != 0)
+	break;
+    }
+
+  w->done = 1;
+
+  return NULL;
+}
+
+/*
+  Start worker n on the nth CPU of cpus, in turn (NULL: anywhere)
+*/
+int32_t
+evetPoolSetCpus(evetPool_t &pool, const cpu_set_t *cpus)
+{
+  if(pool.running)
+    {
+      printf("%s: ERROR: workers already started\n", __func__);
+      return -1;
+    }
+
+  if(cpus == NULL)
+    {
+      pool.pinWorkers = 0;
+      return 0;
+    }
+
+  if(CPU_COUNT(cpus) == 0)
+    {
+      printf("%s: ERROR: empty CPU set\n", __func__);
+      return -1;
+    }
+
+  pool.workerCpus = *cpus;
+  pool.pinWorkers = 1;
+
+  return 0;
+}
+
+int32_t
+evetPoolStart(evetPool_t &pool, evetPoolCallback_t callback, void *arg)
+{
+  if((pool.nWorkers == 0) || (callback == NULL))
+    {
+      printf("%s: ERROR: pool not opened or no callback\n", __func__);
+      return -1;
+    }
+
+  pool.callback = callback;
+  pool.arg = arg;
+
+  int32_t iw;
+  for(iw = 0; iw < pool.nWorkers; iw++)
+    {
+      evetPoolWorker_t &w = pool.worker[iw];
+
+      w.done = 0;
+      w.status = 0;
+      if(evetCreateThread(&w.thread, pool.pinWorkers ? &pool.workerCpus : NULL, iw,
+			  evetPoolWorkerThread, (void *)&w) != 0)
+	{
+	  printf("%s: ERROR: unable to create worker thread %d\n",
+		 __func__, iw);
+	  // let evetPoolClose stop the ones already running
+	  pool.running = iw;
+	  return -1;
+	}
+    }
+  pool.running = pool.nWorkers;
+
+  return 0;
+}
+
+/*
+  Stop the workers, put back their events and detach from the stations
+*/
+int32_t
+evetPoolClose(evetPool_t &pool)
+{
+  int32_t rval = 0, iw;
+
+  pool.quit = 1;
+  for(iw = 0; iw < pool.running; iw++)
+    {
+      evetPoolWorker_t &w = pool.worker[iw];
+
+      // break the worker out of a sleeping et_events_get
+      while(w.done == 0)
+	{
+	  et_wakeup_attachment(pool.etSysId, w.evh.etAttId);
+	  usleep(10000);
+	}
+      pthread_join(w.thread, NULL);
+
+      if(w.status != 0)
+	rval = -1;
+    }
+  pool.running = 0;
+
+  for(iw = 0; iw < pool.nWorkers; iw++)
+    {
+      if(evetClose(pool.worker[iw].evh) != 0)
+	rval = -1;
+    }
+  pool.nWorkers = 0;
+
+  if(pool.worker)
+    free(pool.worker);
+  pool.worker = NULL;
+
+  return rval;
+}
+
+/*
+  Totals over all workers
+*/
+int32_t
+evetPoolGetStats(evetPool_t &pool, evetStats_t &stats)
+{
+  int32_t iw;
+
+  memset(&stats, 0, sizeof(stats));
+
+  for(iw = 0; iw < pool.nWorkers; iw++)
+    {
+      const evetStats_t &ws = pool.worker[iw].evh.stats;
+
+      stats.events      += ws.events;
+      stats.filtered    += ws.filtered;
+      stats.sampledOut  += ws.sampledOut;
+      stats.shed        += ws.shed;
+      stats.bytes       += ws.bytes;
+      stats.chunks      += ws.chunks;
+      stats.emptyChunks += ws.emptyChunks;
+      stats.gets        += ws.gets;
+      stats.emptyGets   += ws.emptyGets;
+      stats.puts        += ws.puts;
+      stats.getNs       += ws.getNs;
+      stats.putNs       += ws.putNs;
+      stats.waitNs      += ws.waitNs;
+      evetHistMerge(stats.getLatency, ws.getLatency);
+      evetHistMerge(stats.putLatency, ws.putLatency);
+    }
+
+  return 0;
+}
+
+/*
+  Fan-out: one attachment, N worker threads.
+
+  A reader thread gets et_events with the handle and pushes every event
+  into the workers' rings in turn.  A worker pops from its own ring, and
+  when that is empty steals from the others, so a slow event doesn't hold
+  up the ones queued behind it.  Each et_events_get array counts the
+  events still out; the reader puts it back once that reaches zero.  The
+  arrays may go back in a different order than they came.
+*/
+
+static int32_t
+evetRingInit(evetRing_t &ring, uint32_t size)
+{
+  uint32_t i;
+
+  ring.cell = (evetRingCell_t *) evetAllocBuffer(size * sizeof(evetRingCell_t));
+  if(ring.cell == NULL)
+    return -1;
+
+  for(i = 0; i < size; i++)
+    ring.cell[i].seq = i;
+  ring.mask = size - 1;
+  ring.head = 0;
+  ring.tail = 0;
+
+  return 0;
+}
+
+// Reader only.  Returns 0 if the ring is full
+static inline int32_t
+evetRingPush(evetRing_t &ring, const evetFanoutItem_t &item)
+{
+  uint64_t pos = ring.tail;
+  evetRingCell_t *cell = &ring.cell[pos & ring.mask];
+
+  if(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos)
+    return 0;
+
+  cell->item = item;
+  ring.tail = pos + 1;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+// Any thread.  Returns 0 if the ring is empty
+static inline int32_t
+evetRingPop(evetRing_t &ring, evetFanoutItem_t &item)
+{
+  uint64_t pos = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+
+  while(1)
+    {
+      evetRingCell_t *cell = &ring.cell[pos & ring.mask];
+      int64_t diff = (int64_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (int64_t)(pos + 1);
+
+      if(diff < 0)
+	return 0;
+
+      if(diff == 0)
+	{
+	  if(__atomic_compare_exchange_n(&ring.head, &pos, pos + 1, 1,
+					 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	    {
+	      item = cell->item;
+	      __atomic_store_n(&cell->seq, pos + ring.mask + 1, __ATOMIC_RELEASE);
+	      return 1;
+	    }
+	  // pos now holds the new head
+	}
+      else
+	pos = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+    }
+}
+
+// Spin, then yield, then sleep, as a thread stays idle
+static inline void
+evetBackoff(uint32_t &idle)
+{
+  idle++;
+  if(idle < 64)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      _mm_pause();
+#endif
+    }
+  else if(idle < 128)
+    sched_yield();
+  else
+    {
+      struct timespec ts = {0, 20000};
+      nanosleep(&ts, NULL);
+    }
+}
+
+// Put back every array whose events have all been released
+static int32_t
+evetFanoutReap(evetFanout_t &fan)
+{
+  int32_t ic, rval = 0;
+
+  for(ic = 0; ic < EVET_FANOUT_NCHUNK; ic++)
+    {
+      evetFanoutChunk_t &c = fan.chunk[ic];
+
+      if((c.busy == 0) || (__atomic_load_n(&c.refs, __ATOMIC_ACQUIRE) != 0))
+	continue;
+
+      if(c.nread > 0)
+	{
+	  int32_t status = evetEtPut(*fan.evh, NULL, c.etChunk, c.nread);
+	  if(status != ET_OK)
+	    {
+	      printf("%s: ERROR: et_events_put returned %s\n",
+		     __func__, et_perror(status));
+	      rval = -1;
+	    }
+	}
+      c.busy = 0;
+    }
+
+  return rval;
+}
+
+/*
+  Queue one event, round robin over the workers.  Returns 0 once queued,
+  1 when quitting, -1 if putting back a finished array failed.
+*/
+static int32_t
+evetFanoutPush(evetFanout_t &fan, const evetFanoutItem_t &item, int32_t &rr)
+{
+  uint32_t idle = 0;
+  int32_t rval = 1;
+
+  __atomic_add_fetch(&fan.chunk[item.chunk].refs, 1, __ATOMIC_RELAXED);
+
+  while(fan.quit == 0)
+    {
+      int32_t i;
+      for(i = 0; i < fan.nWorkers; i++)
+	{
+	  int32_t iw = rr;
+	  rr = (rr + 1) % fan.nWorkers;
+	  if(evetRingPush(fan.worker[iw].ring, item))
+	    return 0;
+	}
+
+      // every ring is full.  Keep returning finished arrays meanwhile
+      if(evetFanoutReap(fan) != 0)
+	{
+	  rval = -1;
+	  break;
+	}
+      evetBackoff(idle);
+    }
+
+  // not queued, so no worker will drop this reference
+  __atomic_sub_fetch(&fan.chunk[item.chunk].refs, 1, __ATOMIC_RELAXED);
+
+  return rval;
+}
+
+static void *
+evetFanoutReaderThread(void *arg)
+{
+  evetFanout_t *fan = (evetFanout_t *) arg;
+  evetHandle_t &evh = *fan->evh;
+  int32_t rr = 0;
+  uint32_t idle = 0;
+
+  while(fan->quit == 0)
+    {
+      if(evetFanoutReap(*fan) != 0)
+	{
+	  fan->status = -1;
+	  break;
+	}
+
+      int32_t ic;
+      for(ic = 0; ic < EVET_FANOUT_NCHUNK; ic++)
+	if(fan->chunk[ic].busy == 0)
+	  break;
+
+      // all arrays are out with the workers
+      if(ic == EVET_FANOUT_NCHUNK)
+	{
+	  evetBackoff(idle);
+	  continue;
+	}
+      idle = 0;
+
+      evetFanoutChunk_t &c = fan->chunk[ic];
+      struct timespec deltatime = {0, EVET_FANOUT_POLL_NS};
+      int32_t nread = 0;
+
+      int32_t status = evetEtGet(evh, NULL, c.etChunk, ET_TIMED, &deltatime, &nread);
+      if((status == ET_ERROR_TIMEOUT) || (status == ET_ERROR_EMPTY) ||
+	 (status == ET_ERROR_BUSY) || (status == ET_ERROR_WAKEUP))
+	continue;
+
+      if(status != ET_OK)
+	{
+	  printf("%s: ERROR: et_events_get returned (%d) %s\n",
+		 __func__, status, et_perror(status));
+	  fan->status = -1;
+	  break;
+	}
+
+      c.nread = nread;
+      c.refs = 1;
+      c.busy = 1;
+
+      int32_t ie;
+      for(ie = 0; (ie < nread) && (fan->status == 0); ie++)
+	{
+	  evh.currentChunkID = ie;
+	  if(evetLoadChunk(evh, c.etChunk[ie]) != 0)
+	    {
+	      fan->status = -1;
+	      break;
+	    }
+
+	  evetFanoutItem_t item;
+	  item.chunk = ic;
+	  int32_t nevents = 0;
+	  while((status = evetNextEvent(evh, &item.data, &item.length)) == 0)
+	    {
+	      item.seq = evh.seq;
+
+	      // don't get further ahead of the oldest unfinished event than
+	      // the reorder stage can hold
+	      if(fan->reorder != NULL)
+		{
+		  struct timespec wait = {0, 10000000};
+		  while((evetReorderWait(*fan->reorder, item.seq, &wait) == EVET_NODATA) &&
+			(fan->quit == 0) && (fan->status == 0))
+		    {
+		      if(evetFanoutReap(*fan) != 0)
+			fan->status = -1;
+		    }
+		  if(fan->status != 0)
+		    break;
+		}
+
+	      int32_t push = evetFanoutPush(*fan, item, rr);
+	      if(push < 0)
+		fan->status = -1;
+	      if(push != 0)
+		break;
+	      nevents++;
+	    }
+
+	  if(status < 0)
+	    {
+	      printf("%s: ERROR: bad EVIO data in chunk %d\n", __func__, ie);
+	      fan->status = -1;
+	    }
+	  else if(nevents == 0)
+	    evh.stats.emptyChunks++;
+
+	  if(fan->quit || (fan->status != 0))
+	    break;
+	}
+
+      // the reader's own reference
+      __atomic_sub_fetch(&c.refs, 1, __ATOMIC_RELEASE);
+
+      if(fan->status != 0)
+	break;
+    }
+
+  evh.currentChunkID = -1;
+
+  return NULL;
+}
+
+static void *
+evetFanoutWorkerThread(void *arg)
+{
+  evetFanoutWorker_t *w = (evetFanoutWorker_t *) arg;
+  evetFanout_t *fan = w->fan;
+  uint32_t idle = 0;
+
+  while(fan->quit == 0)
+    {
+      evetFanoutItem_t item;
+      int32_t got = evetRingPop(w->ring, item);
+
+      // steal, starting with the next worker along
+      int32_t i;
+      for(i = 1; (got == 0) && (i < fan->nWorkers); i++)
+	{
+	  got = evetRingPop(fan->worker[(w->id + i) % fan->nWorkers].ring, item);
+	  if(got)
+	    w->steals++;
+	}
+
+      if(got == 0)
+	{
+	  evetBackoff(idle);
+	  continue;
+	}
+      idle = 0;
+
+      w->seq = item.seq;
+      int32_t stop = (*fan->callback)(w->id, item.data, item.length, fan->arg);
+
+      w->events++;
+      __atomic_sub_fetch(&fan->chunk[item.chunk].refs, 1, __ATOMIC_RELEASE);
+
+      if(stop)
+	break;
+    }
+
+  w->done = 1;
+
+  return NULL;
+}
+
+/*
+  Fan the events of an attached handle out to nWorkers threads.  The
+  handle is the reader's from evetFanoutStart until evetFanoutClose, and
+  must not be using prefetch.
+*/
+int32_t
+evetFanoutOpen(evetHandle_t &evh, int32_t nWorkers, evetFanout_t &fan)
+{
+  EVETCHECKINIT(evh);
+
+  memset(&fan, 0, sizeof(fan));
+
+  if(evh.attached == 0)
+    {
+      printf("%s: ERROR: not attached with evetAttach\n", __func__);
+      return -1;
+    }
+
+  if(evh.prefetch || (evh.etChunkNumRead > 0))
+    {
+      printf("%s: ERROR: handle is prefetching or holds et_events\n", __func__);
+      return -1;
+    }
+
+  if(evh.forward)
+    {
+      printf("%s: ERROR: handle is forwarding (evetSetForward)\n", __func__);
+      return -1;
+    }
+
+  if(nWorkers < 1)
+    {
+      printf("%s: ERROR: invalid number of workers (%d)\n",
+	     __func__, nWorkers);
+      return -1;
+    }
+
+  fan.evh = &evh;
+
+  fan.worker = (evetFanoutWorker_t *) calloc((size_t)nWorkers, sizeof(evetFanoutWorker_t));
+  if (fan.worker == NULL) {
+    printf("%s: out of memory\n", __func__);
+    return -1;
+  }
+
+  int32_t iw, ic;
+  for(iw = 0; iw < nWorkers; iw++)
+    {
+      evetFanoutWorker_t &w = fan.worker[iw];
+      w.fan = &fan;
+      w.id = iw;
+      if(evetRingInit(w.ring, EVET_FANOUT_RING) != 0)
+	{
+	  printf("%s: out of memory\n", __func__);
+	  evetFanoutClose(fan);
+	  return -1;
+	}
+      fan.nWorkers++;
+    }
+
+  for(ic = 0; ic < EVET_FANOUT_NCHUNK; ic++)
+    {
+      fan.chunk[ic].etChunk = (et_event **) calloc((size_t)evh.etChunkAlloc, sizeof(et_event *));
+      if(fan.chunk[ic].etChunk == NULL)
+	{
+	  printf("%s: out of memory\n", __func__);
+	  evetFanoutClose(fan);
+	  return -1;
+	}
+    }
+
+  return 0;
+}
+
+int32_t
+evetFanoutStart(evetFanout_t &fan, evetPoolCallback_t callback, void *arg)
+{
+  if((fan.nWorkers == 0) || (callback == NULL))
+    {
+      printf("%s: ERROR: fan-out not opened or no callback\n", __func__);
+      return -1;
+    }
+
+  fan.callback = callback;
+  fan.arg = arg;
+
+  // the reader on the first of the handle's CPUs, the workers on the next ones
+  const cpu_set_t *cpus = fan.evh->pinThreads ? &fan.evh->threadCpus : NULL;
+
+  int32_t iw;
+  for(iw = 0; iw < fan.nWorkers; iw++)
+    {
+      evetFanoutWorker_t &w = fan.worker[iw];
+
+      w.done = 0;
+      if(evetCreateThread(&w.thread, cpus, iw + 1, evetFanoutWorkerThread, (void *)&w) != 0)
+	{
+	  printf("%s: ERROR: unable to create worker thread %d\n",
+		 __func__, iw);
+	  fan.running = iw;
+	  return -1;
+	}
+    }
+  fan.running = fan.nWorkers;
+
+  if(evetCreateThread(&fan.reader, cpus, 0, evetFanoutReaderThread, (void *)&fan) != 0)
+    {
+      printf("%s: ERROR: unable to create reader thread\n", __func__);
+      return -1;
+    }
+  fan.readerRunning = 1;
+
+  return 0;
+}
+
+/*
+  Stop the reader and the workers, and put back every array still out.
+  Events queued but not yet handled go back unprocessed.
+*/
+int32_t
+evetFanoutClose(evetFanout_t &fan)
+{
+  int32_t rval = 0, iw, ic;
+
+  fan.quit = 1;
+
+  if(fan.readerRunning)
+    {
+      // break the reader out of its get
+      et_wakeup_attachment(fan.evh->etSysId, fan.evh->etAttId);
+      pthread_join(fan.reader, NULL);
+      fan.readerRunning = 0;
+    }
+
+  for(iw = 0; iw < fan.running; iw++)
+    pthread_join(fan.worker[iw].thread, NULL);
+  fan.running = 0;
+
+  for(ic = 0; ic < EVET_FANOUT_NCHUNK; ic++)
+    {
+      evetFanoutChunk_t &c = fan.chunk[ic];
+
+      if(c.busy && (c.nread > 0))
+	{
+	  int32_t status = evetEtPut(*fan.evh, NULL, c.etChunk, c.nread);
+	  if(status != ET_OK)
+	    {
+	      printf("%s: ERROR: et_events_put returned %s\n",
+		     __func__, et_perror(status));
+	      rval = -1;
+	    }
+	}
+      c.busy = 0;
+
+      if(c.etChunk)
+	free(c.etChunk);
+      c.etChunk = NULL;
+    }
+
+  for(iw = 0; iw < fan.nWorkers; iw++)
+    {
+      evetRing_t &ring = fan.worker[iw].ring;
+      evetFreeBuffer(ring.cell, (ring.mask + 1) * sizeof(evetRingCell_t));
+    }
+  fan.nWorkers = 0;
+
+  if(fan.worker)
+    free(fan.worker);
+  fan.worker = NULL;
+
+  if(fan.status != 0)
+    rval = -1;
+
+  return rval;
+}
+
+/*
+  Hold back events that the reorder stage would have no room for.  The
+  callback must evetReorderPut every event, by fan.worker[worker].seq.
+  Set before evetFanoutStart.
+*/
+int32_t
+evetFanoutSetReorder(evetFanout_t &fan, evetReorder_t *reorder)
+{
+  if(fan.running)
+    {
+      printf("%s: ERROR: must be set before evetFanoutStart\n", __func__);
+      return -1;
+    }
+
+  fan.reorder = reorder;
+
+  return 0;
+}
+
+/*
+  Counters of the reader's handle.  Events are counted as they are queued
+*/
+int32_t
+evetFanoutGetStats(evetFanout_t &fan, evetStats_t &stats)
+{
+  if(fan.evh == NULL)
+    return -1;
+
+  stats = fan.evh->stats;
+
+  return 0;
+}
+
+/*
+  Reorder stage
+
+  Events handled in parallel finish out of order.  Each result is put with
+  the sequence number of its event; output is called with the results in
+  sequence order, by whichever thread puts the one that was next.  That
+  one is passed straight through, the others are copied and held.
+
+  The dispatcher calls evetReorderWait before handing out each event, in
+  sequence order.  It holds back events more than window ahead of the
+  oldest unfinished one, or while more than maxBytes are held, so
+  evetReorderPut never has to wait.
+*/
+
+int32_t
+evetReorderOpen(evetReorder_t &ro, uint32_t window, size_t maxBytes,
+		evetReorderOutput_t output, void *arg)
+{
+  memset(&ro, 0, sizeof(ro));
+
+  if((window < 1) || (output == NULL))
+    {
+      printf("%s: ERROR: invalid window (%d) or no output\n", __func__, window);
+      return -1;
+    }
+
+  ro.slot = (evetReorderSlot_t *) calloc(window, sizeof(evetReorderSlot_t));
+  if (ro.slot == NULL) {
+    printf("%s: out of memory\n", __func__);
+    return -1;
+  }
+
+  ro.window = window;
+  ro.maxBytes = maxBytes;
+  ro.output = output;
+  ro.arg = arg;
+
+  pthread_mutex_init(&ro.lock, NULL);
+  pthread_cond_init(&ro.cond, NULL);
+
+  return 0;
+}
+
+/*
+  Wait until the event seq may be handed out.  timeout NULL waits as long
+  as it takes, otherwise returns EVET_NODATA after that long.
+*/
 int32_t
-evetClose(evetHandle_t &evh)
+evetReorderWait(evetReorder_t &ro, uint64_t seq, const struct timespec *timeout)
 {
+  struct timespec abstime;
+
+  if(timeout != NULL)
+    evetAbsTime(timeout, &abstime);
 
-  // Close up any currently opened evBufferOpen's.
-  if(evh.currentChunkStat.evioHandle)
+  pthread_mutex_lock(&ro.lock);
+  while((seq >= ro.next + ro.window) || ((ro.heldBytes > ro.maxBytes) && (seq > ro.next)))
     {
-      int32_t stat = evClose(evh.currentChunkStat.evioHandle);
-      if(stat != S_SUCCESS)
+      if(timeout == NULL)
+	pthread_cond_wait(&ro.cond, &ro.lock);
+      else if(pthread_cond_timedwait(&ro.cond, &ro.lock, &abstime) == ETIMEDOUT)
 	{
-	  printf("%s: ERROR: evClose returned %s\n",
-		 __func__, et_perror(stat));
-	  return -1;
+	  pthread_mutex_unlock(&ro.lock);
+	  return EVET_NODATA;
 	}
     }
+  pthread_mutex_unlock(&ro.lock);
 
-  // put any events we may still have
-  if(evh.etChunkNumRead != -1)
+  return 0;
+}
+
+/*
+  Result of event seq.  nbytes 0: the event has nothing to output, but
+  still must be put so later ones can go.
+*/
+int32_t
+evetReorderPut(evetReorder_t &ro, uint64_t seq, const void *data, uint32_t nbytes)
+{
+  pthread_mutex_lock(&ro.lock);
+
+  if((seq < ro.next) || (seq >= ro.next + ro.window) ||
+     ro.slot[seq % ro.window].ready)
     {
-      /* putting array of events */
-      int32_t status = et_events_put(evh.etSysId, evh.etAttId, evh.etChunk, evh.etChunkNumRead);
-      if (status != ET_OK)
+      pthread_mutex_unlock(&ro.lock);
+      printf("%s: ERROR: sequence number %lu out of window (next %lu)\n",
+	     __func__, seq, ro.next);
+      return -1;
+    }
+
+  if((seq != ro.next) || ro.emitting)
+    {
+      // hold a copy until its turn
+      evetReorderSlot_t &sl = ro.slot[seq % ro.window];
+      if(nbytes > sl.alloc)
 	{
-	  printf("%s: ERROR: et_events_put returned %s\n",
-		 __func__, et_perror(status));
-	  return -1;
+	  void *buf = realloc(sl.data, nbytes);
+	  if(buf == NULL)
+	    {
+	      pthread_mutex_unlock(&ro.lock);
+	      printf("%s: out of memory\n", __func__);
+	      return -1;
+	    }
+	  sl.data = buf;
+	  sl.alloc = nbytes;
 	}
+      if(nbytes > 0)
+	memcpy(sl.data, data, nbytes);
+      sl.nbytes = nbytes;
+      sl.ready = 1;
+
+      ro.heldBytes += nbytes;
+      if(ro.heldBytes > ro.maxHeldBytes)
+	ro.maxHeldBytes = ro.heldBytes;
+
+      pthread_mutex_unlock(&ro.lock);
+      return 0;
     }
 
-  // free up the etChunk memory
-  if(evh.etChunk)
-    free(evh.etChunk);
+  // this one is next: write it out, then any that were waiting on it
+  ro.emitting = 1;
+  pthread_mutex_unlock(&ro.lock);
+
+  if(nbytes > 0)
+    (*ro.output)(seq, data, nbytes, ro.arg);
+
+  pthread_mutex_lock(&ro.lock);
+  ro.next++;
+  ro.released++;
+
+  while(ro.slot[ro.next % ro.window].ready)
+    {
+      // the slot can't be refilled until next moves past it
+      evetReorderSlot_t &sl = ro.slot[ro.next % ro.window];
+      pthread_cond_broadcast(&ro.cond);
+      pthread_mutex_unlock(&ro.lock);
+
+      if(sl.nbytes > 0)
+	(*ro.output)(ro.next, sl.data, sl.nbytes, ro.arg);
+
+      pthread_mutex_lock(&ro.lock);
+      ro.heldBytes -= sl.nbytes;
+      sl.ready = 0;
+      ro.next++;
+      ro.released++;
+    }
+
+  ro.emitting = 0;
+  pthread_cond_broadcast(&ro.cond);
+  pthread_mutex_unlock(&ro.lock);
 
   return 0;
 }
 
-
+/*
+  Results still held (behind one that never came) are dropped
+*/
 int32_t
-evetGetEtChunks(evetHandle_t &evh)
+evetReorderClose(evetReorder_t &ro)
 {
-  if(evh.verbose == 1)
-    printf("%s: enter\n", __func__);
+  uint32_t i;
 
-  EVETCHECKINIT(evh);
+  if(ro.slot == NULL)
+    return 0;
 
-  int32_t status = et_events_get(evh.etSysId, evh.etAttId, evh.etChunk,
-				 ET_SLEEP, NULL, evh.etChunkSize, &evh.etChunkNumRead);
-  if(status != ET_OK)
-    {
-      printf("%s: ERROR: et_events_get returned (%d) %s\n",
-	     __func__, status, et_perror(status));
+  if(ro.heldBytes > 0)
+    printf("%s: dropping %lu bytes held behind sequence number %lu\n",
+	   __func__, ro.heldBytes, ro.next);
 
-      return -1;
+  for(i = 0; i < ro.window; i++)
+    {
+      if(ro.slot[i].data)
+	free(ro.slot[i].data);
     }
+  free(ro.slot);
+  ro.slot = NULL;
 
-  evh.currentChunkID = -1;
+  pthread_cond_destroy(&ro.cond);
+  pthread_mutex_destroy(&ro.lock);
 
   return 0;
 }
 
-int32_t
-evetGetChunk(evetHandle_t &evh)
-{
-  if(evh.verbose == 1)
-    printf("%s: enter\n", __func__);
+/*
+  EVIO file sink
 
-  EVETCHECKINIT(evh);
+  Events are copied once, from the ET event into a large aligned buffer
+  that holds one EVIO (v4) block.  A writer thread writes the buffers to
+  disk (O_DIRECT where the file system allows it) while the next one
+  fills.  O_DIRECT writes must be whole multiples of EVET_SINK_ALIGN, so
+  the unaligned tail of each buffer is carried to the start of the next
+  one.  The last write of a file is padded, then the file is truncated to
+  its real length.
+*/
 
-  evh.currentChunkID++;
+static void *
+evetSinkThread(void *arg)
+{
+  evetSink_t *sink = (evetSink_t *) arg;
 
-  if((evh.currentChunkID >= evh.etChunkNumRead) || (evh.etChunkNumRead == -1))
+  pthread_mutex_lock(&sink->lock);
+  while(1)
     {
-      if(evh.etChunkNumRead != -1)
+      evetSinkBuffer_t *b = &sink->buf[sink->nextWrite];
+
+      while((b->busy == 0) && (sink->quit == 0))
+	pthread_cond_wait(&sink->cond, &sink->lock);
+
+      if(b->busy == 0)
+	break;
+
+      pthread_mutex_unlock(&sink->lock);
+
+      int32_t status = 0;
+
+      if(sink->fd < 0)
 	{
-	  /* putting array of events */
-	  int32_t status = et_events_put(evh.etSysId, evh.etAttId, evh.etChunk, evh.etChunkNumRead);
-	  if (status != ET_OK)
+	  char fname[300];
+	  if(sink->maxFileBytes > 0)
+	    snprintf(fname, sizeof(fname), "%s.%d", sink->name, sink->fileNumber);
+	  else
+	    snprintf(fname, sizeof(fname), "%s", sink->name);
+
+	  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	  sink->fd = open(fname, flags | (sink->direct ? O_DIRECT : 0), 0644);
+	  if((sink->fd < 0) && sink->direct && (errno == EINVAL))
 	    {
-	      printf("%s: ERROR: et_events_put returned %s\n",
-		     __func__, et_perror(status));
-	      return -1;
+	      // not supported by this file system (e.g. tmpfs)
+	      sink->direct = 0;
+	      sink->fd = open(fname, flags, 0644);
+	    }
+
+	  if(sink->fd < 0)
+	    {
+	      printf("%s: ERROR: unable to open %s: %s\n",
+		     __func__, fname, strerror(errno));
+	      status = -1;
 	    }
+	  else
+	    printf("%s: writing %s%s\n", __func__, fname,
+		   sink->direct ? " (O_DIRECT)" : "");
 	}
 
-      // out of chunks.  get some more
-      int32_t stat = evetGetEtChunks(evh);
-      if(stat != 0)
+      size_t done = 0;
+      while((status == 0) && (done < b->nbytes))
 	{
-	  printf("%s: ERROR: evetGetEtChunks(evh) returned %d\n",
-		 __func__, stat);
-	  return -1;
+	  ssize_t n = write(sink->fd, (char *) b->data + done, b->nbytes - done);
+	  if(n < 0)
+	    {
+	      if(errno == EINTR)
+		continue;
+	      if((errno == EINVAL) && sink->direct)
+		{
+		  // O_DIRECT taken at open, but not for writes (some tmpfs,
+		  // overlay).  Carry on buffered
+		  int fl = fcntl(sink->fd, F_GETFL);
+		  if((fl != -1) && (fcntl(sink->fd, F_SETFL, fl & ~O_DIRECT) == 0))
+		    {
+		      sink->direct = 0;
+		      printf("%s: O_DIRECT write refused, writing buffered\n", __func__);
+		      continue;
+		    }
+		  errno = EINVAL;
+		}
+	      printf("%s: ERROR: write failed: %s\n", __func__, strerror(errno));
+	      status = -1;
+	      break;
+	    }
+	  done += n;
 	}
-        evh.currentChunkID++;
 
+      if((status == 0) && b->final)
+	{
+	  if(ftruncate(sink->fd, b->fileBytes) != 0)
+	    {
+	      printf("%s: ERROR: ftruncate failed: %s\n", __func__, strerror(errno));
+	      status = -1;
+	    }
+	  close(sink->fd);
+	  sink->fd = -1;
+	  sink->fileNumber++;
+	  sink->files++;
+	  sink->bytesWritten += b->fileBytes;
+	}
+
+      pthread_mutex_lock(&sink->lock);
+      if(status != 0)
+	sink->status = -1;
+      b->busy = 0;
+      sink->nextWrite = (sink->nextWrite + 1) % EVET_SINK_NBUF;
+      pthread_cond_broadcast(&sink->cond);
+    }
+  pthread_mutex_unlock(&sink->lock);
+
+  return NULL;
+}
+
+static void
+evetSinkStartBlock(evetSink_t &sink)
+{
+  sink.blockStart = sink.fill;
+  sink.blockCount = 0;
+  sink.blockOpen = 1;
+  sink.fill += EVIO_HDR_MINLENGTH;
+}
+
+static void
+evetSinkBlockHeader(uint32_t *header, uint32_t length, uint32_t number,
+		    uint32_t count, int32_t last)
+{
+  memset(header, 0, EVIO_HDR_MINLENGTH * sizeof(uint32_t));
+  header[EVIO_HDR_LENGTH]       = length;
+  header[1]                     = number;
+  header[EVIO_HDR_HEADERLENGTH] = EVIO_HDR_MINLENGTH;
+  header[EVIO_HDR_COUNT]        = count;
+  header[EVIO_HDR_BITINFO]      = 4 | (last ? (1 << 9) : 0);
+  header[EVIO_HDR_MAGIC]        = EVIO_BLOCK_MAGIC;
+}
+
+static void
+evetSinkFinishBlock(evetSink_t &sink)
+{
+  if(sink.blockOpen == 0)
+    return;
+
+  sink.blockOpen = 0;
+  if(sink.blockCount == 0)
+    {
+      sink.fill = sink.blockStart;
+      return;
+    }
+
+  uint32_t length = sink.fill - sink.blockStart;
+  evetSinkBlockHeader(sink.buf[sink.cur].data + sink.blockStart, length,
+		      sink.blockNumber++, sink.blockCount, 0);
+  sink.fileBytes += length * sizeof(uint32_t);
+}
+
+/*
+  Queue buf[cur] for the writer thread and move on to the next buffer.
+  final ends the file with an empty last block.
+*/
+static int32_t
+evetSinkSubmit(evetSink_t &sink, int32_t final)
+{
+  evetSinkBuffer_t *b = &sink.buf[sink.cur];
+  size_t nbytes, tail = 0;
+
+  if(final)
+    {
+      evetSinkBlockHeader(b->data + sink.fill, EVIO_HDR_MINLENGTH, sink.blockNumber, 0, 1);
+      sink.fill += EVIO_HDR_MINLENGTH;
+      sink.fileBytes += EVIO_HDR_MINLENGTH * sizeof(uint32_t);
+
+      nbytes = sink.fill * sizeof(uint32_t);
+      size_t padded = (nbytes + EVET_SINK_ALIGN - 1) & ~((size_t)EVET_SINK_ALIGN - 1);
+      memset((char *) b->data + nbytes, 0, padded - nbytes);
+      nbytes = padded;
     }
+  else
+    {
+      size_t filled = sink.fill * sizeof(uint32_t);
+      nbytes = filled & ~((size_t)EVET_SINK_ALIGN - 1);
+      tail = filled - nbytes;
+    }
+
+  int32_t next = (sink.cur + 1) % EVET_SINK_NBUF;
+
+  pthread_mutex_lock(&sink.lock);
+  while(sink.buf[next].busy && (sink.status == 0))
+    pthread_cond_wait(&sink.cond, &sink.lock);
+
+  if(sink.status != 0)
+    {
+      pthread_mutex_unlock(&sink.lock);
+      return -1;
+    }
+
+  memcpy(sink.buf[next].data, (char *) b->data + nbytes, tail);
+
+  b->nbytes = nbytes;
+  b->final = final;
+  b->fileBytes = sink.fileBytes;
+  b->busy = 1;
+  pthread_cond_broadcast(&sink.cond);
+  pthread_mutex_unlock(&sink.lock);
+
+  sink.cur = next;
+  sink.fill = tail / sizeof(uint32_t);
+  if(final)
+    {
+      sink.fileBytes = 0;
+      sink.blockNumber = 1;
+    }
+
+  return 0;
+}
 
-  // Close previous handle
-  if(evh.currentChunkStat.evioHandle)
+/*
+  Write events to name, starting a new file (name.0, name.1, ...) each time
+  one grows past maxFileBytes, if not 0.
+*/
+int32_t
+evetSinkOpen(const char *name, uint64_t maxFileBytes, evetSink_t &sink)
+{
+  int32_t ibuf;
+
+  memset(&sink, 0, sizeof(sink));
+
+  if(strlen(name) >= sizeof(sink.name))
+    {
+      printf("%s: ERROR: file name is too long\n", __func__);
+      return -1;
+    }
+  strcpy(sink.name, name);
+
+  sink.maxFileBytes = maxFileBytes;
+  sink.direct = 1;
+  sink.fd = -1;
+  sink.blockNumber = 1;
+
+  // room for the tail carried over, and for the closing block header
+  sink.capacity = (EVET_SINK_BUFBYTES + EVET_SINK_ALIGN) / sizeof(uint32_t);
+
+  for(ibuf = 0; ibuf < EVET_SINK_NBUF; ibuf++)
     {
-      int32_t stat = evClose(evh.currentChunkStat.evioHandle);
-      if(stat != ET_OK)
+      // page aligned, as O_DIRECT needs
+      void *data = evetAllocBuffer(sink.capacity * sizeof(uint32_t));
+      if(data == NULL)
 	{
-	  printf("%s: ERROR: evClose returned %s\n",
-		 __func__, et_perror(stat));
+	  printf("%s: out of memory\n", __func__);
+	  while(--ibuf >= 0)
+	    evetFreeBuffer(sink.buf[ibuf].data, sink.capacity * sizeof(uint32_t));
 	  return -1;
 	}
+      sink.buf[ibuf].data = (uint32_t *) data;
     }
 
-  et_event *currentChunk = evh.etChunk[evh.currentChunkID];
-  et_event_getdata(currentChunk, (void **) &evh.currentChunkStat.data);
-  et_event_getlength(currentChunk, &evh.currentChunkStat.length);
-  et_event_getendian(currentChunk, &evh.currentChunkStat.endian);
-  et_event_needtoswap(currentChunk, &evh.currentChunkStat.swap);
+  pthread_mutex_init(&sink.lock, NULL);
+  pthread_cond_init(&sink.cond, NULL);
 
-  if(evh.verbose == 1)
+  if(pthread_create(&sink.thread, NULL, evetSinkThread, (void *)&sink) != 0)
     {
-      uint32_t *data = evh.currentChunkStat.data;
-      uint32_t idata = 0, len = evh.currentChunkStat.length;
+      printf("%s: ERROR: unable to create writer thread\n", __func__);
+      pthread_cond_destroy(&sink.cond);
+      pthread_mutex_destroy(&sink.lock);
+      for(ibuf = 0; ibuf < EVET_SINK_NBUF; ibuf++)
+	evetFreeBuffer(sink.buf[ibuf].data, sink.capacity * sizeof(uint32_t));
+      return -1;
+    }
 
-      printf("data byte order = %s\n",
-	     (evh.currentChunkStat.endian == ET_ENDIAN_BIG) ? "BIG" : "LITTLE");
-      printf(" %2d/%2d: data (len = %d) %s  int = %d\n",
-	     evh.currentChunkID, evh.etChunkNumRead,
-	     (int) len,
-	     evh.currentChunkStat.swap ? "needs swapping" : "does not need swapping",
-	     evh.currentChunkStat.swap ? bswap_32(data[0]) : data[0]);
+  return 0;
+}
 
-      for(idata = 0; idata < ((32 < (len>>2)) ? 32 : (len>>2)); idata++)
+/*
+  Append one event (e.g. straight from evetReadNoCopy).  Events must be in
+  local byte order, as the block headers are.
+*/
+int32_t
+evetSinkWrite(evetSink_t &sink, const uint32_t *event, uint32_t length)
+{
+  if(sink.status != 0)
+    return -1;
+
+  // keep room for the closing block header
+  uint32_t limit = sink.capacity - EVIO_HDR_MINLENGTH;
+
+  if(sink.blockOpen == 0)
+    evetSinkStartBlock(sink);
+
+  if(sink.fill + length > limit)
+    {
+      evetSinkFinishBlock(sink);
+      int32_t final = (sink.maxFileBytes > 0) && (sink.fileBytes >= sink.maxFileBytes);
+      if(evetSinkSubmit(sink, final) != 0)
+	return -1;
+      evetSinkStartBlock(sink);
+
+      if(sink.fill + length > limit)
 	{
-	  printf("0x%08x ", evh.currentChunkStat.swap ? bswap_32(data[idata]) : data[idata]);
-	  if(((idata+1) % 8) == 0)
-	    printf("\n");
+	  printf("%s: ERROR: event of %d words does not fit in a sink buffer\n",
+		 __func__, length);
+	  return -1;
 	}
-      printf("\n");
     }
 
-  int32_t evstat = evOpenBuffer((char *) evh.currentChunkStat.data, evh.currentChunkStat.length,
-			    (char *)"r",  &evh.currentChunkStat.evioHandle);
+  memcpy(sink.buf[sink.cur].data + sink.fill, event, length * sizeof(uint32_t));
+  sink.fill += length;
+  sink.blockCount++;
 
-  if(evstat != 0)
+  if(sink.fill * sizeof(uint32_t) >= EVET_SINK_BUFBYTES)
     {
-      printf("%s: ERROR: evOpenBuffer returned %s\n",
-	     __func__, et_perror(evstat));
+      evetSinkFinishBlock(sink);
+      int32_t final = (sink.maxFileBytes > 0) && (sink.fileBytes >= sink.maxFileBytes);
+      return evetSinkSubmit(sink, final);
     }
 
-  return evstat;
+  return 0;
 }
 
 int32_t
-evetReadNoCopy(evetHandle_t &evh, const uint32_t **outputBuffer, uint32_t *length)
+evetSinkClose(evetSink_t &sink)
 {
-  if(evh.verbose == 1)
-    printf("%s: enter\n", __func__);
+  int32_t ibuf, rval = 0;
 
-  EVETCHECKINIT(evh);
+  evetSinkFinishBlock(sink);
+  if(sink.fileBytes > 0)
+    rval = evetSinkSubmit(sink, 1);
+
+  pthread_mutex_lock(&sink.lock);
+  sink.quit = 1;
+  pthread_cond_broadcast(&sink.cond);
+  pthread_mutex_unlock(&sink.lock);
+
+  pthread_join(sink.thread, NULL);
+
+  if(sink.fd >= 0)
+    close(sink.fd);
+
+  pthread_cond_destroy(&sink.cond);
+  pthread_mutex_destroy(&sink.lock);
+  for(ibuf = 0; ibuf < EVET_SINK_NBUF; ibuf++)
+    evetFreeBuffer(sink.buf[ibuf].data, sink.capacity * sizeof(uint32_t));
+
+  return ((rval != 0) || (sink.status != 0)) ? -1 : 0;
+}
+
+/*
+  Producer
+
+  Events are packed into new et_events (et_events_new) as one EVIO (v4)
+  block each, chunk et_events at a time.  A full array is put when the
+  next event needs a new et_event, or by evetWriterFlush.
+*/
+
+int32_t
+evetWriterOpen(et_sys_id etSysId, int32_t chunk, size_t etEventBytes, evetWriter_t &w)
+{
+  memset(&w, 0, sizeof(w));
 
-  int32_t status = evReadNoCopy(evh.currentChunkStat.evioHandle,
-				outputBuffer, length);
-  if(status != S_SUCCESS)
+  if(chunk < 1)
     {
-      // Get a new chunk from et_get_event
-      status = evetGetChunk(evh);
-      if(status == 0)
+      printf("%s: ERROR: invalid chunk %d\n", __func__, chunk);
+      return -1;
+    }
+
+  if(etEventBytes < (EVIO_HDR_MINLENGTH + 2) * sizeof(uint32_t))
+    {
+      printf("%s: ERROR: et_event size %d too small for an EVIO block\n",
+	     __func__, (int) etEventBytes);
+      return -1;
+    }
+
+  w.etChunk = (et_event **) calloc((size_t)chunk, sizeof(et_event *));
+  if (w.etChunk == NULL) {
+    printf("%s: out of memory\n", __func__);
+    return -1;
+  }
+
+  int32_t status = et_station_attach(etSysId, ET_GRANDCENTRAL, &w.etAttId);
+  if(status != ET_OK)
+    {
+      printf("%s: ERROR: et_station_attach returned %s\n",
+	     __func__, et_perror(status));
+      free(w.etChunk);
+      w.etChunk = NULL;
+      return -1;
+    }
+
+  w.etSysId = etSysId;
+  w.etChunkSize = chunk;
+  w.etEventBytes = etEventBytes;
+  w.blockNumber = 1;
+
+  return 0;
+}
+
+// Close the block of the et_event being filled
+static void
+evetWriterFinish(evetWriter_t &w)
+{
+  if(w.data == NULL)
+    return;
+
+  evetSinkBlockHeader(w.data, w.fill, w.blockNumber++, w.count, 1);
+  et_event_setlength(w.etChunk[w.current], w.fill * sizeof(uint32_t));
+
+  w.data = NULL;
+  w.current++;
+}
+
+/*
+  Put the filled et_events, and dump the new ones that were not used.
+*/
+static int32_t
+evetWriterPut(evetWriter_t &w)
+{
+  int32_t status;
+
+  evetWriterFinish(w);
+
+  if(w.current > 0)
+    {
+      status = et_events_put(w.etSysId, w.etAttId, w.etChunk, w.current);
+      if(status != ET_OK)
 	{
-	  status = evReadNoCopy(evh.currentChunkStat.evioHandle,
-				outputBuffer, length);
+	  printf("%s: ERROR: et_events_put returned %s\n",
+		 __func__, et_perror(status));
+	  return -1;
 	}
-      else
+      w.etEvents += w.current;
+    }
+
+  if(w.etChunkNumRead > w.current)
+    {
+      status = et_events_dump(w.etSysId, w.etAttId, w.etChunk + w.current,
+			      w.etChunkNumRead - w.current);
+      if(status != ET_OK)
 	{
-	  printf("%s: ERROR: evetGetChunk failed %d\n",
-		 __func__, status);
+	  printf("%s: ERROR: et_events_dump returned %s\n",
+		 __func__, et_perror(status));
 	  return -1;
 	}
     }
 
+  w.etChunkNumRead = 0;
+  w.current = 0;
+
+  return 0;
+}
+
+/*
+  Room for an event of length words in the current et_event, for the
+  caller to fill in place before the next evetWrite* or evetWriterFlush.
+  Returns NULL on error.
+*/
+uint32_t *
+evetWriteReserve(evetWriter_t &w, uint32_t length)
+{
+  if(w.etChunk == NULL)
+    {
+      printf("%s: ERROR: writer not open\n", __func__);
+      return NULL;
+    }
+
+  if((length == 0) ||
+     ((EVIO_HDR_MINLENGTH + (size_t)length) * sizeof(uint32_t) > w.etEventBytes))
+    {
+      printf("%s: ERROR: event of %d words does not fit in an et_event\n",
+	     __func__, length);
+      return NULL;
+    }
+
+  if((w.data != NULL) && (w.fill + length > w.capacity))
+    evetWriterFinish(w);
+
+  if(w.data == NULL)
+    {
+      // out of new et_events: put the full array, get more
+      if(w.current >= w.etChunkNumRead)
+	{
+	  if(evetWriterPut(w) != 0)
+	    return NULL;
+
+	  int32_t nread = 0;
+	  int32_t status = et_events_new(w.etSysId, w.etAttId, w.etChunk, ET_SLEEP, NULL,
+					 w.etEventBytes, w.etChunkSize, &nread);
+	  if(status != ET_OK)
+	    {
+	      printf("%s: ERROR: et_events_new returned (%d) %s\n",
+		     __func__, status, et_perror(status));
+	      return NULL;
+	    }
+	  w.etChunkNumRead = nread;
+	}
+
+      et_event_getdata(w.etChunk[w.current], (void **) &w.data);
+      w.capacity = (uint32_t)(w.etEventBytes / sizeof(uint32_t));
+      w.fill = EVIO_HDR_MINLENGTH;
+      w.count = 0;
+    }
+
+  uint32_t *event = w.data + w.fill;
+  w.fill += length;
+  w.count++;
+  w.events++;
+  w.bytes += length * sizeof(uint32_t);
+
+  return event;
+}
+
+/*
+  Copy an event (length words, bank header included) into the current
+  et_event.
+*/
+int32_t
+evetWrite(evetWriter_t &w, const uint32_t *event, uint32_t length)
+{
+  uint32_t *to = evetWriteReserve(w, length);
+  if(to == NULL)
+    return -1;
+
+  memcpy(to, event, length * sizeof(uint32_t));
+
   return 0;
 }
+
+/*
+  Put what has been written so far.
+*/
+int32_t
+evetWriterFlush(evetWriter_t &w)
+{
+  if(w.etChunk == NULL)
+    {
+      printf("%s: ERROR: writer not open\n", __func__);
+      return -1;
+    }
+
+  return evetWriterPut(w);
+}
+
+int32_t
+evetWriterClose(evetWriter_t &w)
+{
+  int32_t rval = 0;
+
+  if(w.etChunk == NULL)
+    return 0;
+
+  if(evetWriterPut(w) != 0)
+    rval = -1;
+
+  int32_t status = et_station_detach(w.etSysId, w.etAttId);
+  if(status != ET_OK)
+    {
+      printf("%s: ERROR: et_station_detach returned %s\n",
+	     __func__, et_perror(status));
+      rval = -1;
+    }
+
+  free(w.etChunk);
+  w.etChunk = NULL;
+
+  return rval;
+}
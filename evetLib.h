@@ -1,7 +1,24 @@
 #pragma once
 
+#include <pthread.h>
+#include <sched.h>
+#include <byteswap.h>
 #include <et.h>
 
+// EVIO block (v4) / record (v6) header words
+#define EVIO_BLOCK_MAGIC      0xc0da0100
+#define EVIO_FILE_ID          0x4556494f  // "EVIO", first word of a v6 file header
+#define EVIO_HDR_LENGTH       0  // block / record length (words)
+#define EVIO_HDR_NUMBER       1  // block / record number
+#define EVIO_HDR_HEADERLENGTH 2  // header length (words)
+#define EVIO_HDR_COUNT        3  // number of events
+#define EVIO_HDR_INDEXLENGTH  4  // v6: index array length (bytes)
+#define EVIO_HDR_BITINFO      5  // version (bits 0-7), last block (bit 9)
+#define EVIO_HDR_USERLENGTH   6  // v6: user header length (bytes)
+#define EVIO_HDR_MAGIC        7
+#define EVIO_HDR_COMPRESSION  9  // v6: compression type (bits 28-31)
+#define EVIO_HDR_MINLENGTH    8
+
 // Attributes of et_event from et_event_getdata
 typedef struct etChunkStat
 {
@@ -10,24 +27,747 @@ typedef struct etChunkStat
   int32_t endian;
   int32_t swap;
 
-  int32_t  evioHandle;
+  // EVIO walker position in data
+  uint32_t *next;            // next event in the current block
+  uint32_t *blockEnd;        // end of the current block (start of the next header)
+  uint32_t *end;             // end of data
+  uint32_t  blockEventsLeft; // events not yet read from the current block
+  int32_t   lastBlock;       // current block has the last block bit set
 } etChunkStat_t;
 
+// Byte swapping of foreign-endian data (evetSetSwapMode)
+#define EVET_SWAP_NONE  0  // events are returned in the byte order of the chunk
+#define EVET_SWAP_CHUNK 1  // swap the whole et_event in place when it is first read
+// swap each whole event (not bank by bank) in place as it is walked.  Before
+// the et_event goes back, the rest of it is swapped and it is marked local
+#define EVET_SWAP_LAZY  2
+
+// evetReadNoCopyTimed / evetReadNoCopyPoll: no events arrived in time
+#define EVET_NODATA 1
+// evetOpenFile: every event in the file has been read
+#define EVET_EOF    2
+
+// evetFormatEvent
+#define EVET_FORMAT_HEX  0  // every word, 8 to a line
+#define EVET_FORMAT_TREE 1  // banks, segments and tagsegments, with the first data words
+#define EVET_FORMAT_TREE_WORDS 8  // data words shown for each leaf
+
+// One event, in place in the ET event data
+typedef struct evetSpan
+{
+  const uint32_t *data;
+  uint32_t length;           // words
+  uint64_t seq;              // sequence number (evetHandle_t seq)
+  int32_t  swap;             // 1: still in foreign byte order (EVET_SWAP_NONE)
+} evetSpan_t;
+
+// Caller-owned buffer that evetReadCopy copies events into, emptied with evetArenaReset
+typedef struct evetArena
+{
+  uint8_t *base;
+  size_t   size;
+  size_t   used;
+} evetArena_t;
+
+#define EVET_ARENA_ALIGN       16        // start of each event copy
+#define EVET_COPY_STREAM_BYTES (64 << 10) // events this big are copied with streaming stores
+
+// Log-linear latency histogram (ns), EVET_HIST_SUB buckets per power of two
+#define EVET_HIST_SUB_BITS 4
+#define EVET_HIST_SUB      (1 << EVET_HIST_SUB_BITS)
+#define EVET_HIST_BUCKETS  ((64 - EVET_HIST_SUB_BITS + 1) * EVET_HIST_SUB)
+
+typedef struct evetHist
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t bucket[EVET_HIST_BUCKETS];
+} evetHist_t;
+
+static inline uint32_t
+evetHistBucket(uint64_t value)
+{
+  if(value < EVET_HIST_SUB)
+    return (uint32_t) value;
+
+  uint32_t msb = 63 - __builtin_clzll(value);
+  uint32_t shift = msb - EVET_HIST_SUB_BITS;
+
+  return (shift + 1) * EVET_HIST_SUB + (uint32_t)((value >> shift) - EVET_HIST_SUB);
+}
+
+static inline void
+evetHistRecord(evetHist_t &hist, uint64_t value)
+{
+  if((hist.count == 0) || (value < hist.min))
+    hist.min = value;
+  if(value > hist.max)
+    hist.max = value;
+  hist.count++;
+  hist.sum += value;
+  hist.bucket[evetHistBucket(value)]++;
+}
+
+// Per-handle counters (evetGetStats)
+typedef struct evetStats
+{
+  uint64_t events;       // events returned
+  uint64_t filtered;     // events rejected by the bank filter
+  uint64_t sampledOut;   // events passed over by evetSetSample
+  uint64_t shed;         // events passed over while overloaded (EVET_BP_SHED)
+  uint64_t bytes;        // bytes in those events
+  uint64_t chunks;       // et_events read
+  uint64_t emptyChunks;  // et_events with no events in them
+  uint64_t gets;         // et_events_get calls
+  uint64_t emptyGets;    // et_events_get calls that returned no et_events
+  uint64_t puts;         // et_events_put calls
+  uint64_t getNs;        // time in et_events_get
+  uint64_t putNs;        // time in et_events_put
+  uint64_t waitNs;       // time the reader was blocked waiting for a chunk
+
+  evetHist_t getLatency; // et_events_get
+  evetHist_t putLatency; // et_events_put
+} evetStats_t;
+
+/*
+  Bank filter, run on each event before it is returned (evetSetFilter).
+  Return non-zero to keep the event.  swap is set if the event is still in
+  foreign byte order.
+*/
+typedef int32_t (*evetFilter_t)(const uint32_t *event, uint32_t length, int32_t swap,
+				const void *arg);
+
+// Runtime filter (evetSetBankFilter).  -1: any
+typedef struct evetBankFilter
+{
+  int32_t tagMin;          // bank tag in tagMin..tagMax
+  int32_t tagMax;
+  int32_t num;
+  int32_t type;
+  int32_t childTag;        // a top-level child bank has this tag
+} evetBankFilter_t;
+
+// Adaptive chunk size: hold events at most about this long at the measured rate
+#define EVET_ADAPT_WINDOW_NS  10000000
+// A full get that returned faster than this found a backlog in the station
+#define EVET_ADAPT_BACKLOG_NS 100000
+
+// Backpressure on the attached station (evetSetBackpressure)
+#define EVET_BP_OFF  -1
+#define EVET_BP_CHUNK 0x1  // while overloaded, get the largest adaptive chunk
+#define EVET_BP_SHED  0x2  // while overloaded, pass over events matching the shed filter
+#define EVET_BP_INTERVAL_NS 100000000  // station lists sampled at most this often
+#define EVET_BP_HIGH 0.75  // input list this full: overloaded
+#define EVET_BP_LOW  0.25  // ... until it drains back to this
+
+typedef struct evetBackpressure
+{
+  int32_t  actions;        // EVET_BP_*, 0: only measure
+  evetBankFilter_t shed;   // low priority events (EVET_BP_SHED)
+
+  int32_t  cue;            // events the input list can hold
+  // occupancy of the station lists at the last sample, not running counts
+  int32_t  inputLevel;     // et_events sitting in the input list
+  int32_t  outputLevel;    // et_events sitting in the output list
+  int32_t  maxInputLevel;
+  uint64_t samples;
+  uint64_t fullSamples;    // samples that found the input list full
+  uint64_t lastSampleNs;
+
+  // et_events that went past a non-blocking station, from gaps in the
+  // EVIO block numbers (a single producer numbering its blocks).  Not
+  // counted (countMissed 0) when the station is prescaled, selects events
+  // or is in a parallel group: it never gets some et_events by design.
+  int32_t  countMissed;
+  uint32_t lastBlock;
+  int32_t  haveBlock;
+  uint64_t blocks;         // et_events whose block number was checked
+  uint64_t missed;
+  uint64_t missedAtSample;
+  double   dropRate;       // missed et_events / s, moving average over samples
+
+  int32_t  overloaded;     // input list over EVET_BP_HIGH, not yet back to EVET_BP_LOW
+  uint64_t overloads;      // times it became overloaded
+} evetBackpressure_t;
+
+// Background get/put of the next chunk (evetSetPrefetch)
+typedef struct evetPrefetch
+{
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+
+  et_event **etChunk;       // chunk owned by the prefetch thread
+  int32_t  etChunkNumRead;  // events in etChunk when state is READY
+  int32_t  putNumRead;      // events in etChunk to put back before the next get
+
+  int32_t  state;           // EVET_PREFETCH_*
+  int32_t  status;          // last ET status from the prefetch thread
+  int32_t  quit;
+
+  // The thread's own get / put stats, adaptive chunk size and station
+  // samples.  Merged into the handle under lock at each swap
+  evetStats_t stats;
+  int32_t  etChunkSize;
+  double   arrivalRate;
+  uint64_t lastGetNs;
+  evetBackpressure_t bp;
+} evetPrefetch_t;
+
+#define EVET_PREFETCH_BUSY  1  // thread is putting / getting
+#define EVET_PREFETCH_READY 2  // etChunk holds a fresh chunk
+#define EVET_PREFETCH_ERROR 3  // put or get failed
+
 typedef struct evetHandle
 {
   et_sys_id etSysId;
   et_att_id etAttId;
+  et_stat_id etStatId;     // station attached to with evetAttach
+  int32_t  attached;       // 1: evetClose detaches from etStatId
   et_event **etChunk;      // pointer to array of et_events (pe)
   int32_t  etChunkSize;    // user requested (et_events in a chunk)
   int32_t  etChunkNumRead; // actual read from et_events_get
+  int32_t  etChunkPut;     // et_events at the front already put back (evetReadCopy)
+  int32_t  etChunkAlloc;   // length of the etChunk arrays
+
+  // adaptive chunk size (evetSetAdaptiveChunk), etChunkMax 0 if fixed
+  int32_t  etChunkMin;
+  int32_t  etChunkMax;
+  double   arrivalRate;    // events / s, moving average over gets
+  uint64_t lastGetNs;      // end of the previous et_events_get
 
   int32_t  currentChunkID;  // j
   etChunkStat_t currentChunkStat; // data, len, endian, swap
+  // event walker for the byte order of the current chunk, set by evetGetChunk
+  int32_t (*nextEvent)(struct evetHandle &evh, const uint32_t **outputBuffer, uint32_t *length);
+
+  int32_t  swapMode;         // EVET_SWAP_*
+  et_event *lazyChunk;       // et_event swapped lazily, to finish before it goes back
+  int32_t  prefetch;         // 1: next chunk fetched by a background thread
+  evetPrefetch_t pf;
+
+  evetFilter_t filter;      // NULL: keep every event
+  const void *filterArg;
+  evetBankFilter_t bankFilter;
+  uint32_t sampleN;         // evetSetSample: return 1 event in sampleN (0, 1: all)
+  uint32_t sampleLeft;      // events until the next one returned
+
+  // evetSetThreadCpus: prefetch and fan-out threads started on these CPUs
+  int32_t  pinThreads;
+  cpu_set_t threadCpus;
+
+  int32_t  backpressure;    // 1: station sampled after each get (evetSetBackpressure)
+  int32_t  shedding;        // overloaded with EVET_BP_SHED
+  evetBackpressure_t bp;
+
+  evetStats_t stats;
+
+  // Events are numbered 0, 1, 2, ... in the order they are returned
+  uint64_t seq;            // sequence number of the last event returned
+  uint64_t nextSeq;
+  uint64_t chunkSeq;       // et_events read so far, counting the current one
+  int32_t  chunkIndex;     // index of the last event returned in the current et_event
+
+  // evetReadCopy: event read, but with no room left in the arena
+  const uint32_t *heldData;
+  uint32_t heldLength;
+  uint64_t heldSeq;
+  int32_t  heldSwap;
+
+  // evetSetForward: events dropped (evetDropEvent, or by the filter) are
+  // taken out of their et_event in place before it is put downstream
+  int32_t  forward;
+  const uint32_t **drops;
+  uint32_t nDrops;
+  uint32_t maxDrops;
+
+  // evetOpenFile: events come from a memory-mapped EVIO file, not from ET
+  uint32_t *fileData;      // NULL: reading from ET
+  size_t   fileBytes;
 
   int32_t verbose;
 
 } evetHandle_t ;
 
+/*
+  Non-zero while the station is backing up (evetSetBackpressure), so the
+  caller can skip its expensive processing until it drains.
+*/
+static inline int32_t
+evetOverloaded(const evetHandle_t &evh)
+{
+  return evh.bp.overloaded;
+}
+
+/*
+  Bank header fields of an event
+*/
+static inline uint32_t
+evetEventWord(const uint32_t *event, uint32_t i, int32_t swap)
+{
+  return swap ? bswap_32(event[i]) : event[i];
+}
+
+static inline uint32_t
+evetBankTag(const uint32_t *event, int32_t swap)
+{
+  return evetEventWord(event, 1, swap) >> 16;
+}
+
+static inline uint32_t
+evetBankType(const uint32_t *event, int32_t swap)
+{
+  return (evetEventWord(event, 1, swap) >> 8) & 0x3f;
+}
+
+static inline uint32_t
+evetBankNum(const uint32_t *event, int32_t swap)
+{
+  return evetEventWord(event, 1, swap) & 0xff;
+}
+
+// Does a top-level child bank have this tag
+static inline int32_t
+evetHasChildTag(const uint32_t *event, uint32_t length, int32_t swap, uint32_t tag)
+{
+  uint32_t type = evetBankType(event, swap);
+  if((type != 0xe) && (type != 0x10))  // not a bank of banks
+    return 0;
+
+  uint32_t pos = 2;
+  while(pos + 1 < length)
+    {
+      if((evetEventWord(event, pos + 1, swap) >> 16) == tag)
+	return 1;
+
+      uint32_t next = pos + evetEventWord(event, pos, swap) + 1;
+      if(next <= pos)  // bad length
+	return 0;
+      pos = next;
+    }
+
+  return 0;
+}
+
+/*
+  Predicates for evetSetFilter<>, combined at compile time, e.g.
+    evetSetFilter< evetAnd< evetTagIs<0xff50>, evetHasChild<0x1> > >(evh);
+  The whole predicate is inlined into one filter function.
+*/
+template <uint16_t TAG> struct evetTagIs
+{
+  static inline int32_t match(const uint32_t *ev, uint32_t len, int32_t swap)
+  { return evetBankTag(ev, swap) == TAG; }
+};
+
+template <uint16_t LO, uint16_t HI> struct evetTagIn
+{
+  static inline int32_t match(const uint32_t *ev, uint32_t len, int32_t swap)
+  { uint32_t tag = evetBankTag(ev, swap); return (tag >= LO) && (tag <= HI); }
+};
+
+template <uint8_t NUM> struct evetNumIs
+{
+  static inline int32_t match(const uint32_t *ev, uint32_t len, int32_t swap)
+  { return evetBankNum(ev, swap) == NUM; }
+};
+
+template <uint8_t TYPE> struct evetTypeIs
+{
+  static inline int32_t match(const uint32_t *ev, uint32_t len, int32_t swap)
+  { return evetBankType(ev, swap) == TYPE; }
+};
+
+template <uint16_t TAG> struct evetHasChild
+{
+  static inline int32_t match(const uint32_t *ev, uint32_t len, int32_t swap)
+  { return evetHasChildTag(ev, len, swap, TAG); }
+};
+
+template <class A, class B> struct evetAnd
+{
+  static inline int32_t match(const uint32_t *ev, uint32_t len, int32_t swap)
+  { return A::match(ev, len, swap) && B::match(ev, len, swap); }
+};
+
+template <class A, class B> struct evetOr
+{
+  static inline int32_t match(const uint32_t *ev, uint32_t len, int32_t swap)
+  { return A::match(ev, len, swap) || B::match(ev, len, swap); }
+};
+
+template <class A> struct evetNot
+{
+  static inline int32_t match(const uint32_t *ev, uint32_t len, int32_t swap)
+  { return !A::match(ev, len, swap); }
+};
+
+template <class Pred> static int32_t
+evetFilterThunk(const uint32_t *event, uint32_t length, int32_t swap, const void *arg)
+{
+  return Pred::match(event, length, swap);
+}
+
+template <class Pred> static inline int32_t
+evetSetFilter(evetHandle_t &evh)
+{
+  evh.filter = evetFilterThunk<Pred>;
+  evh.filterArg = NULL;
+  return 0;
+}
+
+// Called by each pool worker for every event.  Return non-zero to stop that worker.
+typedef int32_t (*evetPoolCallback_t)(int32_t worker, const uint32_t *buffer,
+				      uint32_t length, void *arg);
+
+struct evetPool;
+
+typedef struct evetPoolWorker
+{
+  struct evetPool *pool;
+  int32_t   id;
+  pthread_t thread;
+  et_stat_id etStatId;     // this worker's station in the parallel group
+  evetHandle_t evh;
+
+  int32_t   status;        // -1 if the read loop stopped on an error
+  volatile int32_t done;   // read loop has returned
+} evetPoolWorker_t;
+
+// N attachments, one per worker thread, on a group of parallel stations
+typedef struct evetPool
+{
+  et_sys_id etSysId;
+  int32_t   nWorkers;
+  evetPoolWorker_t *worker;
+
+  evetPoolCallback_t callback;
+  void     *arg;
+  int32_t   running;
+  volatile int32_t quit;
+
+  int32_t   pinWorkers;    // evetPoolSetCpus: worker n on the nth of workerCpus
+  cpu_set_t workerCpus;
+} evetPool_t;
+
+// Thread placement and internal buffers
+#define EVET_HUGEPAGE_BYTES (2 << 20)  // buffers this big are backed by hugepages
+
+int32_t  evetParseCpus(const char *list, cpu_set_t *cpus);
+int32_t  evetPinThread(pthread_t thread, const cpu_set_t *cpus, int32_t index);
+void    *evetAllocBuffer(size_t size);
+void     evetFreeBuffer(void *p, size_t size);
+
 int32_t  evetOpen(et_sys_id etSysId, int32_t chunk, evetHandle_t &evh);
+int32_t  evetOpenFile(const char *path, evetHandle_t &evh);
+int32_t  evetAttach(evetHandle_t &evh, et_stat_id etStatId);
+int32_t  evetStationConfigSelect(et_statconfig sconfig, int32_t mode, const int32_t *words,
+				 const char *function, const char *lib);
+int32_t  evetSetSelectWords(evetHandle_t &evh, const int32_t *words);
 int32_t  evetClose(evetHandle_t &evh);
+int32_t  evetSetPrefetch(evetHandle_t &evh, int32_t enable);
+int32_t  evetSetSwapMode(evetHandle_t &evh, int32_t mode);
+int32_t  evetSetAdaptiveChunk(evetHandle_t &evh, int32_t min, int32_t max);
+int32_t  evetSetThreadCpus(evetHandle_t &evh, const cpu_set_t *cpus);
+int32_t  evetSetFilterFunction(evetHandle_t &evh, evetFilter_t filter, const void *arg);
+int32_t  evetSetBankFilter(evetHandle_t &evh, const evetBankFilter_t &bankFilter);
+int32_t  evetGetStats(evetHandle_t &evh, evetStats_t &stats);
+int32_t  evetResetStats(evetHandle_t &evh);
+void     evetPrintStats(const evetStats_t &stats);
+uint64_t evetHistPercentile(const evetHist_t &hist, double percentile);
+void     evetHistMerge(evetHist_t &to, const evetHist_t &from);
+int32_t  evetSwapEvent(uint32_t *event, uint32_t length);
 int32_t  evetReadNoCopy(evetHandle_t &evh, const uint32_t **outputBuffer, uint32_t *length);
+int32_t  evetReadNoCopyTimed(evetHandle_t &evh, const uint32_t **outputBuffer, uint32_t *length,
+			     const struct timespec *timeout);
+int32_t  evetReadNoCopyPoll(evetHandle_t &evh, const uint32_t **outputBuffer, uint32_t *length);
+int32_t  evetReadBatch(evetHandle_t &evh, evetSpan_t *spans, uint32_t maxN, uint32_t *nOut);
+int32_t  evetSetForward(evetHandle_t &evh, int32_t enable);
+int32_t  evetSetSample(evetHandle_t &evh, uint32_t n);
+int32_t  evetSetBackpressure(evetHandle_t &evh, int32_t actions, const evetBankFilter_t *shed);
+int32_t  evetGetBackpressure(evetHandle_t &evh, evetBackpressure_t &bp);
+void     evetPrintBackpressure(const evetBackpressure_t &bp);
+size_t   evetFormatEvent(char *buf, size_t size, const uint32_t *event, uint32_t length,
+			 int32_t swap, int32_t mode);
+int32_t  evetDropEvent(evetHandle_t &evh, const uint32_t *event);
+int32_t  evetArenaInit(evetArena_t &arena, size_t size);
+void     evetArenaReset(evetArena_t &arena);
+void     evetArenaFree(evetArena_t &arena);
+int32_t  evetReadCopy(evetHandle_t &evh, evetArena_t &arena, evetSpan_t *spans, uint32_t maxN,
+		      uint32_t *nOut, const struct timespec *timeout);
+
+int32_t  evetPoolOpen(et_sys_id etSysId, const char *stationName, et_statconfig sconfig,
+		      int32_t position, int32_t nWorkers, int32_t chunk, evetPool_t &pool);
+int32_t  evetPoolSetCpus(evetPool_t &pool, const cpu_set_t *cpus);
+int32_t  evetPoolStart(evetPool_t &pool, evetPoolCallback_t callback, void *arg);
+int32_t  evetPoolClose(evetPool_t &pool);
+int32_t  evetPoolGetStats(evetPool_t &pool, evetStats_t &stats);
+
+// One attachment fanned out to N worker threads in this process (evetFanoutOpen)
+#define EVET_FANOUT_NCHUNK  4        // et_events_get arrays in flight
+#define EVET_FANOUT_RING    4096     // events queued per worker (power of 2)
+#define EVET_FANOUT_POLL_NS 1000000  // longest reader get, between put checks
+
+typedef struct evetFanoutItem
+{
+  const uint32_t *data;
+  uint32_t length;           // words
+  int32_t  chunk;            // index in evetFanout_t chunk[]
+  uint64_t seq;
+} evetFanoutItem_t;
+
+// Bounded ring, one producer (the reader), any number of consumers
+typedef struct evetRingCell
+{
+  uint64_t seq;
+  evetFanoutItem_t item;
+} evetRingCell_t;
+
+typedef struct evetRing
+{
+  evetRingCell_t *cell;
+  uint64_t mask;
+  uint64_t head __attribute__((aligned(64)));  // next to pop
+  uint64_t tail __attribute__((aligned(64)));  // next to push
+} evetRing_t;
+
+// An et_events_get array, put back once every event in it is released
+typedef struct evetFanoutChunk
+{
+  et_event **etChunk;
+  int32_t  nread;
+  int32_t  busy;             // holds et_events
+  int32_t  refs;             // events not yet released, +1 while the reader fills
+} evetFanoutChunk_t;
+
+/*
+  Results of events handled out of order, released in sequence order
+  (evetReorderOpen).  output is called for one result at a time.
+*/
+typedef void (*evetReorderOutput_t)(uint64_t seq, const void *data, uint32_t nbytes,
+				    void *arg);
+
+typedef struct evetReorderSlot
+{
+  void    *data;
+  uint32_t nbytes;
+  uint32_t alloc;
+  int32_t  ready;
+} evetReorderSlot_t;
+
+typedef struct evetReorder
+{
+  evetReorderSlot_t *slot;   // result of seq in slot[seq % window]
+  uint32_t window;           // sequence numbers ahead of next that can be out
+  size_t   maxBytes;         // hold back new events while more than this is held
+  size_t   heldBytes;
+  uint64_t next;             // next sequence number to release
+  int32_t  emitting;         // a thread is in output
+
+  evetReorderOutput_t output;
+  void    *arg;
+
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+
+  uint64_t released;
+  size_t   maxHeldBytes;     // high water mark of heldBytes
+} evetReorder_t;
+
+struct evetFanout;
+
+typedef struct evetFanoutWorker
+{
+  struct evetFanout *fan;
+  int32_t   id;
+  pthread_t thread;
+  evetRing_t ring;         // filled by the reader, emptied by this worker and thieves
+  uint64_t  seq;           // sequence number of the event in the callback
+
+  uint64_t  events;        // events handled
+  uint64_t  steals;        // of those, taken from another worker's ring
+  volatile int32_t done;
+} evetFanoutWorker_t;
+
+typedef struct evetFanout
+{
+  evetHandle_t *evh;
+  int32_t   nWorkers;
+  evetFanoutWorker_t *worker;
+  evetFanoutChunk_t chunk[EVET_FANOUT_NCHUNK];
+
+  pthread_t reader;
+  evetPoolCallback_t callback;
+  void     *arg;
+  evetReorder_t *reorder;  // NULL: events are handed out without waiting
+  int32_t   running;       // worker threads started
+  int32_t   readerRunning;
+  int32_t   status;        // -1 if the reader stopped on an error
+  volatile int32_t quit;
+} evetFanout_t;
+
+int32_t  evetFanoutOpen(evetHandle_t &evh, int32_t nWorkers, evetFanout_t &fan);
+int32_t  evetFanoutStart(evetFanout_t &fan, evetPoolCallback_t callback, void *arg);
+int32_t  evetFanoutClose(evetFanout_t &fan);
+int32_t  evetFanoutGetStats(evetFanout_t &fan, evetStats_t &stats);
+int32_t  evetFanoutSetReorder(evetFanout_t &fan, evetReorder_t *reorder);
+
+int32_t  evetReorderOpen(evetReorder_t &ro, uint32_t window, size_t maxBytes,
+			 evetReorderOutput_t output, void *arg);
+int32_t  evetReorderWait(evetReorder_t &ro, uint64_t seq, const struct timespec *timeout);
+int32_t  evetReorderPut(evetReorder_t &ro, uint64_t seq, const void *data, uint32_t nbytes);
+int32_t  evetReorderClose(evetReorder_t &ro);
+
+// Several handles, e.g. one per ET system, read as one (evetMultiOpen)
+#define EVET_MULTI_IDLE_NS 100000  // sleep between rounds when no source had events
+
+typedef struct evetMultiSource
+{
+  evetHandle_t *evh;
+  int32_t  quantum;          // events read from this source per turn
+  int32_t  paused;           // 1: skipped, so events back up in its station
+  uint64_t turns;            // turns that returned events
+  uint64_t emptyPolls;       // turns that found nothing
+} evetMultiSource_t;
+
+typedef struct evetMulti
+{
+  evetMultiSource_t *source;
+  int32_t  nSources;
+  int32_t  maxSources;
+  int32_t  current;          // source whose turn it is
+  int32_t  credit;           // events left in its turn
+  uint64_t idleNs;           // time slept with every source empty
+} evetMulti_t;
+
+int32_t  evetMultiOpen(evetMulti_t &mh, int32_t maxSources);
+int32_t  evetMultiAdd(evetMulti_t &mh, evetHandle_t &evh, int32_t quantum);
+int32_t  evetMultiSetPaused(evetMulti_t &mh, int32_t source, int32_t paused);
+int32_t  evetMultiRead(evetMulti_t &mh, const uint32_t **outputBuffer, uint32_t *length,
+		       int32_t *source, const struct timespec *timeout);
+void     evetMultiPrintStats(const evetMulti_t &mh);
+int32_t  evetMultiClose(evetMulti_t &mh);
+
+// EVIO (v4) file writer (evetSinkOpen)
+#define EVET_SINK_NBUF     4          // buffers in flight
+#define EVET_SINK_BUFBYTES (8 << 20)  // a buffer (one EVIO block) is written once this full
+#define EVET_SINK_ALIGN    4096       // O_DIRECT alignment of buffers, lengths and offsets
+
+typedef struct evetSinkBuffer
+{
+  uint32_t *data;
+  size_t    nbytes;        // to write, a multiple of EVET_SINK_ALIGN
+  int32_t   final;         // last write to this file: truncate to fileBytes and close
+  uint64_t  fileBytes;     // length of the file when final
+  int32_t   busy;          // queued for, or being written by, the writer thread
+} evetSinkBuffer_t;
+
+typedef struct evetSink
+{
+  char      name[256];
+  uint64_t  maxFileBytes;  // rotate to a new file beyond this (0: one file)
+  int32_t   direct;        // 1: open with O_DIRECT
+
+  evetSinkBuffer_t buf[EVET_SINK_NBUF];
+  uint32_t  capacity;      // words in each buffer
+  int32_t   cur;           // buffer being filled
+  uint32_t  fill;          // words in buf[cur]
+  int32_t   blockOpen;     // a block header is at blockStart
+  uint32_t  blockStart;
+  uint32_t  blockCount;    // events in the open block
+  uint32_t  blockNumber;
+  uint64_t  fileBytes;     // bytes in the current file so far
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  int32_t   quit;
+  int32_t   status;        // -1 after a failed open or write
+
+  // writer thread
+  int       fd;
+  int32_t   nextWrite;     // next buffer to write
+  int32_t   fileNumber;
+  int32_t   files;         // files closed
+  uint64_t  bytesWritten;  // in closed files
+} evetSink_t;
+
+int32_t  evetSinkOpen(const char *name, uint64_t maxFileBytes, evetSink_t &sink);
+int32_t  evetSinkWrite(evetSink_t &sink, const uint32_t *event, uint32_t length);
+int32_t  evetSinkClose(evetSink_t &sink);
+
+// Producer: events packed as one EVIO (v4) block per new et_event (evetWriterOpen)
+typedef struct evetWriter
+{
+  et_sys_id etSysId;
+  et_att_id etAttId;
+  et_event **etChunk;       // from et_events_new
+  int32_t  etChunkSize;     // et_events asked for in each et_events_new
+  int32_t  etChunkNumRead;  // et_events from the last et_events_new, 0 for none
+  int32_t  current;         // et_event being filled
+  size_t   etEventBytes;    // size of the new et_events
+
+  uint32_t *data;           // data of the current et_event
+  uint32_t capacity;        // words in it
+  uint32_t fill;            // words used, block header included
+  uint32_t count;           // events in the block
+  uint32_t blockNumber;
+
+  uint64_t events;
+  uint64_t bytes;
+  uint64_t etEvents;        // put
+} evetWriter_t;
+
+int32_t  evetWriterOpen(et_sys_id etSysId, int32_t chunk, size_t etEventBytes,
+			evetWriter_t &w);
+int32_t  evetWrite(evetWriter_t &w, const uint32_t *event, uint32_t length);
+uint32_t *evetWriteReserve(evetWriter_t &w, uint32_t length);
+int32_t  evetWriterFlush(evetWriter_t &w);
+int32_t  evetWriterClose(evetWriter_t &w);
+
+/*
+  CODA built events, decoded into arrays (evetCodaDecode).  Entry i of
+  every array is one physics event; a multi-event block of M gives M
+  entries that share the ROC banks of its physics bank.
+*/
+#define EVET_CODA_PHYSICS_MIN 0xff50  // built physics event bank tags
+#define EVET_CODA_PHYSICS_MAX 0xff8f
+#define EVET_CODA_TRIGGER_MIN 0xff20  // built trigger bank tags
+#define EVET_CODA_TRIGGER_MAX 0xff2f
+#define EVET_CODA_TRIG_TIMESTAMP 0x1  // trigger tag bit: timestamps present
+#define EVET_CODA_TRIG_RUNINFO   0x2  // trigger tag bit: run number and type present
+
+typedef struct evetCodaSoA
+{
+  uint32_t n;                // entries filled
+  uint32_t capacity;
+  uint32_t nRoc;             // ROC columns used
+  uint32_t maxRoc;
+
+  uint64_t *eventNumber;
+  uint64_t *timestamp;       // 0 if the trigger bank has none
+  uint16_t *eventType;
+  const uint32_t **event;    // the physics bank of the entry
+
+  uint32_t *rocId;           // [maxRoc]: ROC id of each column
+  uint32_t *rocOffset;       // [roc * capacity + i]: ROC bank in event[i], words.  0: absent
+  uint32_t *rocLength;       // [roc * capacity + i]: words, with the header
+
+  uint32_t runNumber;        // from the last trigger bank with run info
+  uint32_t runType;
+  uint64_t skipped;          // events that are not built physics events
+  uint64_t rocOverflow;      // ROC banks with no column left
+} evetCodaSoA_t;
+
+int32_t  evetCodaSoAInit(evetCodaSoA_t &soa, uint32_t capacity, uint32_t maxRoc);
+void     evetCodaSoAClear(evetCodaSoA_t &soa);
+void     evetCodaSoAFree(evetCodaSoA_t &soa);
+int32_t  evetCodaDecode(evetCodaSoA_t &soa, const uint32_t *event, uint32_t length, int32_t swap);
+int32_t  evetCodaDecodeBatch(evetCodaSoA_t &soa, const evetSpan_t *spans, uint32_t n,
+			     uint32_t *nDone);
+
+// Bank tag of the timestamped events from et_producer (make bench).
+// Payload: send time (ns, CLOCK_REALTIME) low word, high word, sequence, filler
+#define EVET_BENCH_TAG 0xbe01
@@ -0,0 +1,182 @@
+#pragma once
+
+/*
+  C++ interface over evetHandle_t, header only.
+
+    evet::Handle h(etSysId, chunk);
+    evetAttach(h, stat);
+    for (evet::EvioEventView ev : evet::events(h))
+      analyze(ev.data(), ev.size());
+
+  Inside an EVIO block each event comes from inline code here; only at
+  block and chunk boundaries (and with a filter or lazy swap set) does it
+  go through evetReadNoCopy.  The view points into the ET event and is
+  valid until the reader moves past that et_event.
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include "evetLib.h"
+
+namespace evet
+{
+
+// One event, in place.  std::span-like, plus the bank header fields
+class EvioEventView
+{
+public:
+  EvioEventView() : data_(NULL), size_(0), swap_(0) {}
+  EvioEventView(const uint32_t *data, uint32_t size, int32_t swap = 0)
+    : data_(data), size_(size), swap_(swap) {}
+
+  const uint32_t *data() const { return data_; }
+  uint32_t size() const { return size_; }          // words
+  size_t   size_bytes() const { return size_ * sizeof(uint32_t); }
+  bool     empty() const { return size_ == 0; }
+  const uint32_t *begin() const { return data_; }
+  const uint32_t *end() const { return data_ + size_; }
+  uint32_t operator[](uint32_t i) const { return data_[i]; }
+
+  // still in foreign byte order (swap mode EVET_SWAP_NONE)
+  bool     swapped() const { return swap_ != 0; }
+  uint32_t word(uint32_t i) const { return evetEventWord(data_, i, swap_); }
+
+  uint32_t tag() const  { return evetBankTag(data_, swap_); }
+  uint32_t type() const { return evetBankType(data_, swap_); }
+  uint32_t num() const  { return evetBankNum(data_, swap_); }
+
+private:
+  const uint32_t *data_;
+  uint32_t size_;
+  int32_t  swap_;
+};
+
+/*
+  Next event.  timeout as for evetReadNoCopyTimed (NULL: wait).
+  Returns 0, EVET_NODATA or -1, like the C calls.
+*/
+inline int32_t
+next(evetHandle_t &evh, EvioEventView &ev, const struct timespec *timeout = NULL)
+{
+  etChunkStat_t &cs = evh.currentChunkStat;
+
+  // fast path: the next event of a native block, nothing to do to it
+  if((cs.blockEventsLeft > 0) && (evh.filter == NULL) && (evh.sampleN <= 1) &&
+     (evh.shedding == 0) && (cs.swap == 0))
+    {
+      uint32_t len = *cs.next + 1;
+      if((size_t)(cs.blockEnd - cs.next) >= len)
+	{
+	  ev = EvioEventView(cs.next, len, 0);
+	  cs.next += len;
+	  cs.blockEventsLeft--;
+	  evh.seq = evh.nextSeq++;
+	  evh.chunkIndex++;
+	  evh.stats.events++;
+	  evh.stats.bytes += len * sizeof(uint32_t);
+	  return 0;
+	}
+      // a bad length is reported by the walker below
+    }
+
+  const uint32_t *buf;
+  uint32_t len;
+  int32_t status = evetReadNoCopyTimed(evh, &buf, &len, timeout);
+  if(status != 0)
+    return status;
+
+  ev = EvioEventView(buf, len, cs.swap && (evh.swapMode != EVET_SWAP_LAZY));
+
+  return 0;
+}
+
+/*
+  Input range of events, for range-based for.  Ends on an error, or with a
+  timeout when no event came in time; status() says which.
+*/
+class EventRange
+{
+public:
+  class iterator
+  {
+  public:
+    iterator() : range_(NULL) {}
+    explicit iterator(EventRange *range) : range_(range) { advance(); }
+
+    const EvioEventView &operator*() const { return range_->current_; }
+    const EvioEventView *operator->() const { return &range_->current_; }
+    iterator &operator++() { advance(); return *this; }
+    bool operator==(const iterator &o) const { return range_ == o.range_; }
+    bool operator!=(const iterator &o) const { return range_ != o.range_; }
+
+  private:
+    void advance()
+    {
+      range_->status_ = next(*range_->evh_, range_->current_, range_->timeout_);
+      if(range_->status_ != 0)
+	range_ = NULL;
+    }
+
+    EventRange *range_;
+  };
+
+  EventRange(evetHandle_t &evh, const struct timespec *timeout)
+    : evh_(&evh), timeout_(timeout), status_(0) {}
+
+  iterator begin() { return iterator(this); }
+  iterator end() { return iterator(); }
+
+  int32_t status() const { return status_; }
+
+private:
+  evetHandle_t *evh_;
+  const struct timespec *timeout_;
+  EvioEventView current_;
+  int32_t status_;
+};
+
+inline EventRange
+events(evetHandle_t &evh, const struct timespec *timeout = NULL)
+{
+  return EventRange(evh, timeout);
+}
+
+/*
+  Owns an evetHandle_t: evetOpen (or evetOpenFile, given a path) when made,
+  evetClose when it goes away.  Converts to evetHandle_t & for the C calls.
+*/
+class Handle
+{
+public:
+  Handle(et_sys_id etSysId, int32_t chunk)
+  {
+    memset(&evh_, 0, sizeof(evh_));
+    status_ = evetOpen(etSysId, chunk, evh_);
+  }
+
+  explicit Handle(const char *path)
+  {
+    memset(&evh_, 0, sizeof(evh_));
+    status_ = evetOpenFile(path, evh_);
+  }
+
+  ~Handle()
+  {
+    if(status_ == 0)
+      evetClose(evh_);
+  }
+
+  bool ok() const { return status_ == 0; }
+
+  operator evetHandle_t &() { return evh_; }
+  evetHandle_t &get() { return evh_; }
+
+  Handle(const Handle &) = delete;
+  Handle &operator=(const Handle &) = delete;
+
+private:
+  evetHandle_t evh_;
+  int32_t status_;
+};
+
+} // namespace evet
@@ -0,0 +1,74 @@
+#!/bin/bash
+#
+# File:
+#    evet_bench.sh
+#
+# Description:
+#    End-to-end throughput / latency sweep of et_consumer.
+#    For each event size, start a local ET system and et_producer, then run
+#    et_consumer -bench over each chunk size, with a blocking and a
+#    non-blocking station.  Prints one "bench:" line per run.
+#
+# Usage:
+#    evet_bench.sh [-t seconds] [-r rate Hz] [-c "chunks"] [-s "sizes"]
+#
+
+CODA=${CODA:-/daqfs/daq_setups/coda/3.10_devel}
+ET_BIN=${ET_BIN:-${CODA}/Linux-x86_64/bin}
+
+SECONDS_PER_RUN=5
+RATE=0
+CHUNKS="1 10 100"
+SIZES="64 1024 16384"
+
+while getopts "t:r:c:s:" opt; do
+    case $opt in
+	t) SECONDS_PER_RUN=$OPTARG ;;
+	r) RATE=$OPTARG ;;
+	c) CHUNKS=$OPTARG ;;
+	s) SIZES=$OPTARG ;;
+	*) echo "usage: $0 [-t seconds] [-r rate Hz] [-c \"chunks\"] [-s \"sizes\"]"; exit 2 ;;
+    esac
+done
+
+ET_FILE=/tmp/evet_bench_$$
+PER_BLOCK=10
+NRUNS=0
+for c in ${CHUNKS}; do NRUNS=$((NRUNS + 2)); done
+
+cleanup() {
+    [ -n "${PRODUCER}" ] && kill ${PRODUCER} 2>/dev/null
+    [ -n "${ET}" ] && kill ${ET} 2>/dev/null
+    wait 2>/dev/null
+    rm -f ${ET_FILE}
+}
+trap cleanup EXIT
+
+for size in ${SIZES}; do
+    # room for one EVIO block of PER_BLOCK events per ET event
+    ET_SIZE=$(( (8 + PER_BLOCK * ((size + 3) / 4)) * 4 ))
+
+    ${ET_BIN}/et_start -f ${ET_FILE} -n 1000 -s ${ET_SIZE} > /dev/null 2>&1 &
+    ET=$!
+    sleep 2
+
+    # keep events flowing for the whole sweep at this size
+    ./et_producer -f ${ET_FILE} -s ${size} -r ${RATE} -b ${PER_BLOCK} \
+	-t $(( NRUNS * (SECONDS_PER_RUN + 2) + 2 )) > /dev/null &
+    PRODUCER=$!
+    sleep 1
+
+    echo "event size ${size} bytes"
+    for chunk in ${CHUNKS}; do
+	for nb in "" "-nb"; do
+	    ./et_consumer -f ${ET_FILE} -s bench_${chunk}${nb} -c ${chunk} ${nb} \
+		-bench ${SECONDS_PER_RUN} | grep "^bench:"
+	done
+    done
+
+    kill ${PRODUCER} ${ET} 2>/dev/null
+    wait 2>/dev/null
+    PRODUCER=
+    ET=
+    rm -f ${ET_FILE}
+done
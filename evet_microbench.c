@@ -0,0 +1,444 @@
+/*----------------------------------------------------------------------------*
+ *
+ * Description:
+ *      In-memory microbenchmark of the evetLib read path.
+ *
+ *      Synthetic EVIO (v4) chunks are built in memory and served by a mock
+ *      of et_events_get / et_events_put / et_event_get*, which take the
+ *      place of the ET library calls of the same name.  Each case (event
+ *      size x byte order x bank layout) is read with evetReadNoCopy and with
+ *      evetReadBatch, and the cost per event is printed: time, and from the
+ *      perf counters instructions, cycles, branch misses and cache misses.
+ *
+ *      Swapped chunks are read in EVET_SWAP_NONE mode, so the pool can be
+ *      read over and over: the walker and bank header reads pay for the
+ *      byte order, the payload is not swapped.
+ *
+ *----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "et.h"
+#include "evetLib.c"
+
+/*
+  Mock ET layer.  The et_events handed out point at mockEvent_t, not at
+  real ET events; only the calls the read path makes are replaced.
+*/
+typedef struct mockEvent
+{
+  uint32_t *data;
+  size_t    length;          // bytes
+  int       swap;
+} mockEvent_t;
+
+static mockEvent_t *mockPool = NULL;
+static int          mockPoolN = 0;
+static int          mockNext = 0;
+
+extern "C" {
+
+int
+et_events_get(et_sys_id id, et_att_id att, et_event *pe[], int wait,
+	      struct timespec *deltatime, int num, int *nread)
+{
+  int i;
+
+  for (i = 0; i < num; i++) {
+    pe[i] = (et_event *) &mockPool[mockNext];
+    if (++mockNext == mockPoolN)
+      mockNext = 0;
+  }
+  *nread = num;
+
+  return ET_OK;
+}
+
+int
+et_events_put(et_sys_id id, et_att_id att, et_event *pe[], int num)
+{
+  return ET_OK;
+}
+
+int
+et_event_getdata(et_event *pe, void **data)
+{
+  *data = ((mockEvent_t *) pe)->data;
+  return ET_OK;
+}
+
+int
+et_event_getlength(et_event *pe, size_t *len)
+{
+  *len = ((mockEvent_t *) pe)->length;
+  return ET_OK;
+}
+
+int
+et_event_getendian(et_event *pe, int *endian)
+{
+  int local = (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) ? ET_ENDIAN_BIG : ET_ENDIAN_LITTLE;
+  int other = (local == ET_ENDIAN_BIG) ? ET_ENDIAN_LITTLE : ET_ENDIAN_BIG;
+
+  *endian = ((mockEvent_t *) pe)->swap ? other : local;
+  return ET_OK;
+}
+
+int
+et_event_needtoswap(et_event *pe, int *swap)
+{
+  *swap = ((mockEvent_t *) pe)->swap;
+  return ET_OK;
+}
+
+int
+et_event_setendian(et_event *pe, int endian)
+{
+  return ET_OK;
+}
+
+}
+
+/*
+  Fill pool with chunks of one EVIO block each, perChunk events of
+  eventWords words.  An event is a bank of banks holding nBanks uint32
+  banks that share the payload.
+*/
+static uint32_t *
+buildPool(int nChunks, int perChunk, uint32_t eventWords, uint32_t nBanks, int swap)
+{
+  uint32_t  blockWords = EVIO_HDR_MINLENGTH + (uint32_t)perChunk * eventWords;
+  uint32_t *buf, *b, *ev, *bank;
+  uint32_t  payload = eventWords - 2 - 2 * nBanks;
+  int       i, j, k;
+  size_t    w, nwords = (size_t)nChunks * blockWords;
+
+  buf = (uint32_t *) malloc(nwords * sizeof(uint32_t));
+  if (buf == NULL)
+    return NULL;
+
+  for (i = 0; i < nChunks; i++) {
+    b = buf + (size_t)i * blockWords;
+    memset(b, 0, EVIO_HDR_MINLENGTH * sizeof(uint32_t));
+    b[EVIO_HDR_LENGTH]       = blockWords;
+    b[1]                     = (uint32_t)i + 1;
+    b[EVIO_HDR_HEADERLENGTH] = EVIO_HDR_MINLENGTH;
+    b[EVIO_HDR_COUNT]        = (uint32_t)perChunk;
+    b[EVIO_HDR_BITINFO]      = 4 | (1 << 9);
+    b[EVIO_HDR_MAGIC]        = EVIO_BLOCK_MAGIC;
+
+    for (j = 0; j < perChunk; j++) {
+      ev = b + EVIO_HDR_MINLENGTH + (size_t)j * eventWords;
+      ev[0] = eventWords - 1;
+      ev[1] = (1 << 16) | (0x10 << 8) | (uint32_t)(j & 0xff);
+
+      bank = ev + 2;
+      for (k = 0; k < (int)nBanks; k++) {
+	uint32_t len = payload / nBanks + ((uint32_t)k < payload % nBanks);
+	bank[0] = len + 1;
+	bank[1] = ((uint32_t)(k + 2) << 16) | (0x1 << 8) | (uint32_t)(k & 0xff);
+	for (w = 0; w < len; w++)
+	  bank[2 + w] = (uint32_t)(i + j + w);
+	bank += 2 + len;
+      }
+    }
+  }
+
+  // every word is a uint32, so swapping each word gives foreign EVIO
+  if (swap)
+    for (w = 0; w < nwords; w++)
+      buf[w] = bswap_32(buf[w]);
+
+  return buf;
+}
+
+/*
+  Hardware counters of this thread, counted in user space.  Missing counters
+  (no PMU, perf_event_paranoid) read as -1.
+*/
+#define NCOUNTERS 4
+static const uint64_t counterConfig[NCOUNTERS] =
+  { PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES };
+static const char *counterName[NCOUNTERS] = { "ins", "cyc", "br-miss", "llc-miss" };
+static int counterFd[NCOUNTERS] = { -1, -1, -1, -1 };
+
+static void
+countersOpen(void)
+{
+  struct perf_event_attr attr;
+  int i;
+
+  for (i = 0; i < NCOUNTERS; i++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = counterConfig[i];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    counterFd[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+}
+
+static void
+countersStart(void)
+{
+  int i;
+
+  for (i = 0; i < NCOUNTERS; i++)
+    if (counterFd[i] >= 0) {
+      ioctl(counterFd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(counterFd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static void
+countersStop(int64_t *value)
+{
+  int i;
+
+  for (i = 0; i < NCOUNTERS; i++) {
+    value[i] = -1;
+    if (counterFd[i] >= 0) {
+      uint64_t v;
+      ioctl(counterFd[i], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(counterFd[i], &v, sizeof(v)) == sizeof(v))
+	value[i] = (int64_t) v;
+    }
+  }
+}
+
+static uint64_t
+nowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#define BATCH 64
+
+/*
+  Read nEvents events through the handle, touching the tag of each.
+  Returns 0, or -1 on a read error.
+*/
+static int
+readEvents(evetHandle_t &evh, int batch, int64_t nEvents, uint64_t *sum)
+{
+  const uint32_t *buf;
+  uint32_t        len, n, i;
+  evetSpan_t      spans[BATCH];
+  int64_t         done = 0;
+
+  while (done < nEvents) {
+    if (batch) {
+      if (evetReadBatch(evh, spans, BATCH, &n) != 0)
+	return -1;
+      for (i = 0; i < n; i++)
+	*sum += evetBankTag(spans[i].data, spans[i].swap) + spans[i].length;
+      done += n;
+    }
+    else {
+      if (evetReadNoCopy(evh, &buf, &len) != 0)
+	return -1;
+      *sum += evetBankTag(buf, evh.currentChunkStat.swap) + len;
+      done++;
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc,char **argv)
+{
+  int             c, i_tmp, i, k, errflg=0, chunk=10, swap, layout, batch;
+  int64_t         nEvents=10000000;
+  size_t          poolBytes=64 << 20, chunkBytes=64 << 10;
+  char            sizeList[256], *word, *save;
+  unsigned int    sizes[32];
+  int             nSizes=0;
+  uint64_t        sum=0;
+  evetHandle_t    evh;
+
+  strcpy(sizeList, "16,64,256,1024,16384");
+
+  while ((c = getopt(argc, argv, "hn:c:s:m:b:")) != EOF) {
+
+    switch (c) {
+    case 'n':
+      nEvents = atoll(optarg);
+      if (nEvents <= 0) {
+	printf("Invalid argument to -n. Must be > 0.\n");
+	exit(-1);
+      }
+      break;
+
+    case 'c':
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0 && i_tmp < 1001) {
+	chunk = i_tmp;
+      } else {
+	printf("Invalid argument to -c. Must < 1001 & > 0.\n");
+	exit(-1);
+      }
+      break;
+
+    case 's':
+      if (strlen(optarg) >= sizeof(sizeList)) {
+	fprintf(stderr, "size list is too long\n");
+	exit(-1);
+      }
+      strcpy(sizeList, optarg);
+      break;
+
+    case 'm':
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0) {
+	poolBytes = (size_t)i_tmp << 20;
+      } else {
+	printf("Invalid argument to -m. Must be > 0.\n");
+	exit(-1);
+      }
+      break;
+
+    case 'b':
+      i_tmp = atoi(optarg);
+      if (i_tmp > 0) {
+	chunkBytes = (size_t)i_tmp << 10;
+      } else {
+	printf("Invalid argument to -b. Must be > 0.\n");
+	exit(-1);
+      }
+      break;
+
+    case 'h':
+    case '?':
+    default:
+      errflg++;
+    }
+  }
+
+  for (word = strtok_r(sizeList, ",", &save); word != NULL && nSizes < 32;
+       word = strtok_r(NULL, ",", &save)) {
+    i_tmp = atoi(word);
+    if (i_tmp < 16) {
+      printf("Invalid event size %s. Must be >= 16.\n", word);
+      errflg++;
+    }
+    sizes[nSizes++] = (unsigned int)i_tmp;
+  }
+
+  if (optind < argc || errflg || nSizes == 0) {
+    fprintf(stderr,
+	    "\nusage: %s  %s\n\n",
+	    argv[0], "[-h] [-n <events>] [-c <chunk>] [-s <bytes>,<bytes>,...] [-m <MB>] [-b <kB>]");
+
+    fprintf(stderr, "          -n    events read in each case (default 10000000)\n");
+    fprintf(stderr, "          -c    number of et_events in one get/put array (default 10)\n");
+    fprintf(stderr, "          -s    event sizes in bytes, rounded up to words (default 16,64,256,1024,16384)\n");
+    fprintf(stderr, "          -m    size of the chunk pool in MB, larger than the caches (default 64)\n");
+    fprintf(stderr, "          -b    data in each et_event in kB (default 64)\n\n");
+    exit(2);
+  }
+
+  countersOpen();
+  if (counterFd[0] < 0)
+    printf("perf counters not available, only time is measured\n");
+
+  printf("%6s %6s %7s %7s %8s %7s", "bytes", "banks", "order", "path", "ev/chunk", "ns/ev");
+  for (i = 0; i < NCOUNTERS; i++)
+    printf(" %9s", counterName[i]);
+  printf("\n");
+
+  for (i = 0; i < nSizes; i++) {
+    uint32_t eventWords = (sizes[i] + 3) >> 2;
+    int      perChunk = (int)(chunkBytes / (eventWords * sizeof(uint32_t)));
+    if (perChunk < 1)
+      perChunk = 1;
+    size_t   blockBytes = (EVIO_HDR_MINLENGTH + (size_t)perChunk * eventWords) * sizeof(uint32_t);
+    int      nChunks = (int)(poolBytes / blockBytes);
+    if (nChunks < chunk)
+      nChunks = chunk;
+
+    // many tiny banks (one data word each) or one large one
+    for (layout = 0; layout < 2; layout++) {
+      uint32_t nBanks = layout ? 1 : (eventWords - 2) / 3;
+      if (nBanks < 2 && layout == 0)
+	continue;
+
+      for (swap = 0; swap < 2; swap++) {
+	uint32_t *buf = buildPool(nChunks, perChunk, eventWords, nBanks, swap);
+	if (buf == NULL) {
+	  printf("%s: out of memory\n", argv[0]);
+	  exit(1);
+	}
+
+	mockPool = (mockEvent_t *) calloc((size_t)nChunks, sizeof(mockEvent_t));
+	if (mockPool == NULL) {
+	  printf("%s: out of memory\n", argv[0]);
+	  exit(1);
+	}
+	for (k = 0; k < nChunks; k++) {
+	  mockPool[k].data = buf + (size_t)k * (blockBytes / sizeof(uint32_t));
+	  mockPool[k].length = blockBytes;
+	  mockPool[k].swap = swap;
+	}
+	mockPoolN = nChunks;
+
+	for (batch = 0; batch < 2; batch++) {
+	  int64_t  value[NCOUNTERS];
+	  uint64_t t0, t1;
+	  int      j;
+
+	  mockNext = 0;
+	  memset(&evh, 0, sizeof(evh));
+	  if (evetOpen((et_sys_id) mockPool, chunk, evh) != 0)
+	    exit(1);
+
+	  // one pass over the pool first, so each case starts the same way
+	  if (readEvents(evh, batch, (int64_t)nChunks * perChunk, &sum) != 0)
+	    exit(1);
+
+	  t0 = nowNs();
+	  countersStart();
+	  if (readEvents(evh, batch, nEvents, &sum) != 0)
+	    exit(1);
+	  countersStop(value);
+	  t1 = nowNs();
+
+	  evetClose(evh);
+
+	  printf("%6u %6u %7s %7s %8d %7.2f", eventWords * 4, nBanks,
+		 swap ? "swapped" : "native", batch ? "batch" : "nocopy", perChunk,
+		 (double)(t1 - t0) / nEvents);
+	  for (j = 0; j < NCOUNTERS; j++) {
+	    if (value[j] < 0)
+	      printf(" %9s", "-");
+	    else
+	      printf(" %9.2f", (double)value[j] / nEvents);
+	  }
+	  printf("\n");
+	}
+
+	free(mockPool);
+	mockPool = NULL;
+	free(buf);
+      }
+    }
+  }
+
+  // keep the reads from being optimized away
+  if (sum == 1)
+    printf("\n");
+
+  return 0;
+}